@@ -0,0 +1,61 @@
+/* Channels: millions of values a second through one channel, for 1 */
+/* to 4 producer and consumer threads and two capacities */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#define M (1 << 19)
+
+lchan* chan;
+int producers, consumers;
+
+void* produce(void* arg) {
+  for (long i = 0; i < M / producers; i++) { lchan_send(chan, lval_num(i)); }
+  return NULL;
+}
+
+void* consume(void* arg) {
+  long sum = 0;
+  for (long i = 0; i < M / consumers; i++) {
+    lval* v = lchan_recv(chan);
+    sum += v->num;
+    lval_del(v);
+  }
+  *(long*)arg = sum;
+  return NULL;
+}
+
+int main(void) {
+  jlisp_isolate_del(jlisp_isolate_new());
+  
+  printf("%-10s %10s %10s\n", "prod/cons", "cap 16", "cap 1024");
+  for (producers = 1; producers <= 4; producers *= 2) {
+    for (consumers = 1; consumers <= 4; consumers *= 2) {
+      printf("%4d/%-5d", producers, consumers);
+      for (long cap = 16; cap <= 1024; cap *= 64) {
+        chan = lchan_new(cap);
+        pthread_t p[4], c[4];
+        long sums[4], sum = 0;
+        double t0 = now();
+        for (int i = 0; i < consumers; i++) { pthread_create(&c[i], NULL, consume, &sums[i]); }
+        for (int i = 0; i < producers; i++) { pthread_create(&p[i], NULL, produce, NULL); }
+        for (int i = 0; i < producers; i++) { pthread_join(p[i], NULL); }
+        for (int i = 0; i < consumers; i++) { pthread_join(c[i], NULL); sum += sums[i]; }
+        double t = now() - t0;
+        
+        long want = (long)producers * (M / producers) * (M / producers - 1) / 2;
+        printf(" %10.2f%s", M / t * 1e-6, sum == want ? "" : " (lost values)");
+        lchan_release(chan);
+      }
+      printf("\n");
+    }
+  }
+  printf("(million values per second)\n");
+  return 0;
+}
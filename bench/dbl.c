@@ -0,0 +1,73 @@
+/* Double printing: ns per number for ldbl_format against the printf */
+/* and strtod searches lval_dbl_print used before it */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#define N 1000000
+
+uint64_t seed = 88172645463325252ull;
+uint64_t rnd(void) {
+  seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+  return seed;
+}
+
+/* 15 to 17 digits, the first that reads back */
+int print_17(char* buf, double x) {
+  for (int prec = 15; prec <= 17; prec++) {
+    snprintf(buf, 32, "%.*g", prec, x);
+    if (strtod(buf, NULL) == x) { break; }
+  }
+  return strlen(buf);
+}
+
+/* Binary search over 1 to 17 digits, first probing 15 */
+int print_search(char* buf, double x) {
+  unsigned lo = 1, hi = 17, mid = 15;
+  while (lo < hi) {
+    snprintf(buf, 32, "%.*g", (int)mid, x);
+    if (strtod(buf, NULL) == x) { hi = mid; } else { lo = mid + 1; }
+    mid = (lo + hi) / 2;
+  }
+  return snprintf(buf, 32, "%.*g", (int)lo, x);
+}
+
+double xs[N];
+
+int main(void) {
+  jlisp_isolate_del(jlisp_isolate_new());
+  
+  const char* kinds[] = { "random bits", "short decimals" };
+  const char* names[] = { "15-17 digits", "digit search", "ldbl_format" };
+  int (*printers[])(char*, double) = { print_17, print_search, ldbl_format };
+  
+  printf("%-16s %14s %14s %14s\n", "ns/number", names[0], names[1], names[2]);
+  for (int k = 0; k < 2; k++) {
+    for (int i = 0; i < N; i++) {
+      if (k == 0) {
+        uint64_t b = rnd();
+        memcpy(&xs[i], &b, sizeof(double));
+        if (!isfinite(xs[i]) || xs[i] == 0) { xs[i] = 0.5; }
+      } else {
+        xs[i] = (double)(long)(rnd() % 2000001 - 1000000) / 1000 + 0.0005;
+      }
+    }
+    
+    printf("%-16s", kinds[k]);
+    for (int p = 0; p < 3; p++) {
+      char buf[32];
+      double t = now();
+      for (int i = 0; i < N; i++) { printers[p](buf, xs[i]); }
+      t = now() - t;
+      printf(" %14.1f", t / N * 1e9);
+    }
+    putchar('\n');
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/* Lists: microseconds per call of list builtins on lists of growing */
+/* length, with the lists held in the environment as programs do. */
+/* Each runs on array-backed Q-Expressions, Pair lists and Ropes */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+FILE* devnull;
+
+/* Evaluate input until 0.2s has gone, in microseconds per evaluation */
+double time_eval(jlisp_isolate* iso, const char* input) {
+  long done = 0;
+  double t0 = now(), t;
+  do { jlisp_eval(iso, "bench", input, devnull); done++; }
+  while ((t = now() - t0) < 0.2);
+  return t / done * 1e6;
+}
+
+const char* kinds[] = { "Q-Expressions", "Pairs", "Ropes" };
+const char* makes[] = { "", "pair ", "rope " };
+
+/* def {name} {1 2 ... n}, made into a Pair list or Rope by kind */
+void def_list(jlisp_isolate* iso, const char* name, int n, int kind) {
+  char* s = malloc(32 + n * 12);
+  char* p = s + sprintf(s, "def {%s} (%s{", name, makes[kind]);
+  for (int i = 0; i < n; i++) { p += sprintf(p, "%d ", i); }
+  sprintf(p, "})");
+  jlisp_eval(iso, "bench", s, devnull);
+  free(s);
+}
+
+const char* ops[] = {
+  "head (join x y)",
+  "head (join x {1})",
+  "head (join {1} x)",
+  "head x",
+  "head (tail x)",
+  "head (cons 0 x)",
+};
+
+int main(void) {
+  devnull = fopen("/dev/null", "w");
+  jlisp_isolate* iso = jlisp_isolate_new();
+  int nops = sizeof(ops) / sizeof(ops[0]);
+  
+  for (int kind = 0; kind < 3; kind++) {
+    printf("%-15s n =  ", kinds[kind]);
+    for (int n = 1000; n <= 1000000; n *= 10) { printf(" %10d", n); }
+    printf("\n");
+    
+    double us[8][4];
+    for (int k = 0, n = 1000; n <= 1000000; k++, n *= 10) {
+      def_list(iso, "x", n, kind);
+      def_list(iso, "y", n, kind);
+      for (int i = 0; i < nops; i++) { us[i][k] = time_eval(iso, ops[i]); }
+    }
+    for (int i = 0; i < nops; i++) {
+      printf("%-20s", ops[i]);
+      for (int k = 0; k < 4; k++) { printf(" %10.1f", us[i][k]); }
+      printf("\n");
+    }
+  }
+  printf("(us per call)\n");
+  
+  jlisp_isolate_del(iso);
+  return 0;
+}
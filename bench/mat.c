@@ -0,0 +1,72 @@
+/* Matrices: GFLOP/s of lmat_mul, with the scalar and installed */
+/* kernels, against the plain triple loop, from 8x8 to 1024x1024 */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* c = a * b, all n x n row-major */
+void naive(double* c, double* a, double* b, int n) {
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      double s = 0;
+      for (int k = 0; k < n; k++) { s += a[i*n + k] * b[k*n + j]; }
+      c[i*n + j] = s;
+    }
+  }
+}
+
+/* Repeat call for 0.2s, or once if that takes longer, in GFLOP/s */
+#define GFLOPS(out, call) do { \
+  long done = 0; double t0 = now(), t; \
+  do { call; done++; } while ((t = now() - t0) < 0.2); \
+  out = 2.0 * n * n * n * done / t * 1e-9; \
+} while (0)
+
+int main(void) {
+  jlisp_isolate_del(jlisp_isolate_new());
+  lmat_kernel installed = lmat_kernel_best;
+  
+  printf("%6s %10s %10s %10s %10s\n", "n", "naive", "scalar", "installed", "max error");
+  for (int n = 8; n <= 1024; n *= 2) {
+    lmat* a = lmat_new(n, n);
+    lmat* b = lmat_new(n, n);
+    for (long i = 0; i < (long)n * n; i++) {
+      a->at[i] = (i * 7 % 13) - 6;
+      b->at[i] = (i * 5 % 11) * 0.5;
+    }
+    double* c = malloc(sizeof(double) * n * n);
+    double g0 = 0, g1, g2;
+    
+    /* The triple loop takes minutes at 1024 */
+    if (n <= 512) { GFLOPS(g0, naive(c, a->at, b->at, n)); }
+    else { naive(c, a->at, b->at, n); }
+    
+    lmat* r = NULL;
+    lmat_kernel_best = lmat_kernel_scalar;
+    GFLOPS(g1, if (r) { lmat_del(r); } r = lmat_mul(a, b));
+    lmat_kernel_best = installed;
+    GFLOPS(g2, lmat_del(r); r = lmat_mul(a, b));
+    
+    double err = 0;
+    for (long i = 0; i < (long)n * n; i++) {
+      double d = fabs(r->at[i] - c[i]);
+      if (d > err) { err = d; }
+    }
+    
+    char naive_s[16] = "-";
+    if (g0) { snprintf(naive_s, sizeof(naive_s), "%.2f", g0); }
+    printf("%6d %10s %10.2f %10.2f %10.2g\n", n, naive_s, g1, g2, err);
+    lmat_del(r);
+    lmat_del(a);
+    lmat_del(b);
+    free(c);
+  }
+  printf("(GFLOP/s)\n");
+  return 0;
+}
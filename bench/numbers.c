@@ -0,0 +1,72 @@
+/* Integer literals: millions per second and GB/s for lread_long */
+/* against strtol, on literals of a given length and of mixed lengths */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+#include <errno.h>
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#define N 2000000
+
+uint64_t seed = 88172645463325252ull;
+uint64_t rnd(void) {
+  seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+  return seed;
+}
+
+char* buf;
+long off[N+1];
+
+/* N literals of len digits each, or 1 to 19 if len is 0, a quarter */
+/* of them negative, each followed by a space */
+long fill(int len) {
+  long o = 0;
+  for (int i = 0; i < N; i++) {
+    off[i] = o;
+    int n = len ? len : 1 + rnd() % 19;
+    if (rnd() % 4 == 0) { buf[o++] = '-'; }
+    buf[o++] = '1' + rnd() % 9;
+    for (int j = 1; j < n; j++) { buf[o++] = '0' + rnd() % 10; }
+    buf[o++] = ' ';
+  }
+  off[N] = o;
+  return o;
+}
+
+int main(void) {
+  buf = malloc((long)N * 21);
+  printf("%-8s %22s %22s\n", "digits", "strtol M/s GB/s", "lread_long M/s GB/s");
+  int lens[] = { 1, 4, 8, 12, 16, 19, 0 };
+  for (int k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+    long bytes = fill(lens[k]);
+    
+    double t = now();
+    long acc = 0;
+    for (int i = 0; i < N; i++) {
+      errno = 0;
+      long x = strtol(buf + off[i], NULL, 10);
+      acc += errno ? 0 : x;
+    }
+    double d1 = now() - t;
+    
+    t = now();
+    for (int i = 0; i < N; i++) {
+      long x = 0;
+      acc -= lread_long(buf + off[i], buf + off[i+1] - 1, &x) ? x : 0;
+    }
+    double d2 = now() - t;
+    
+    char name[16];
+    snprintf(name, sizeof(name), lens[k] ? "%d" : "1-19", lens[k]);
+    printf("%-8s %14.1f %7.2f %14.1f %7.2f%s\n", name,
+      N / d1 / 1e6, bytes / d1 / 1e9, N / d2 / 1e6, bytes / d2 / 1e9,
+      acc ? "  (results differ)" : "");
+  }
+  free(buf);
+  return 0;
+}
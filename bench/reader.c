@@ -0,0 +1,105 @@
+/* Reader: MB/s reading multi-megabyte sources with the mpc grammar, */
+/* the hand-written reader, and the hand-written reader split over */
+/* the pool's threads */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+uint64_t seed = 88172645463325252ull;
+uint64_t rnd(void) {
+  seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+  return seed;
+}
+
+/* Code: top-level defs of nested expressions, symbols and numbers */
+char* gen_code(char* p, int depth) {
+  const char* syms[] = { "head", "tail", "join", "list", "eval", "+", "-", "*" };
+  *p++ = depth % 2 ? '{' : '(';
+  int n = 1 + rnd() % 5;
+  for (int i = 0; i < n; i++) {
+    if (i) { *p++ = ' '; }
+    int k = rnd() % 8;
+    if (depth < 6 && k < 3) { p = gen_code(p, depth + 1); }
+    else if (k < 6) { p += sprintf(p, "%s", syms[rnd() % 8]); }
+    else { p += sprintf(p, "%ld", (long)(rnd() % 100000) - 50000); }
+  }
+  *p++ = depth % 2 ? '}' : ')';
+  return p;
+}
+
+/* Data: rows of numbers in Q-Expressions, a few per line */
+char* gen_data(char* p) {
+  p += sprintf(p, "def {row} {");
+  for (int i = 0; i < 16; i++) {
+    p += sprintf(p, i % 4 == 3 ? "%ld\n  " : "%ld ", (long)(rnd() % 2000000000) - 1000000000);
+  }
+  p += sprintf(p, "}");
+  return p;
+}
+
+char* gen(long size, int data) {
+  char* s = malloc(size + 4096);
+  char* p = s;
+  while (p - s < size) {
+    if (data) { p = gen_data(p); }
+    else { p += sprintf(p, "def {f} "); p = gen_code(p, 0); }
+    *p++ = '\n';
+  }
+  *p = '\0';
+  return s;
+}
+
+/* MB/s reading input once with each reader */
+double rate(const char* input, int which) {
+  long len = strlen(input);
+  char* err = NULL;
+  double t0 = now();
+  lval* x;
+  if (which == 0) {
+    mpc_result_t r;
+    x = mpc_parse("bench", input, Lispy, &r) ? r.output : NULL;
+    if (!x) { mpc_err_delete(r.error); }
+  } else if (which == 1) {
+    x = lread("bench", input, input + len, 1, 1, &err);
+  } else {
+    x = lread_parallel("bench", input, input + len, &err);
+  }
+  double t = now() - t0;
+  if (!x) { printf("read failed\n"); free(err); return 0; }
+  lval_del(x);
+  return len / t * 1e-6;
+}
+
+int main(void) {
+  jlisp_isolate_del(jlisp_isolate_new());
+  
+  printf("%d threads\n", lpool_size());
+  printf("%-6s %6s %10s %10s %10s\n", "input", "KB", "mpc", "lread", "parallel");
+  for (int data = 0; data < 2; data++) {
+    for (long kb = 256; kb <= 16384; kb *= 4) {
+      char* s = gen(kb << 10, data);
+      printf("%-6s %6ld", data ? "data" : "code", kb);
+      for (int which = 0; which < 3; which++) {
+        /* mpc slows down as the input grows, and takes minutes a MB */
+        if (which == 0 && kb > 256) { printf(" %10s", "-"); continue; }
+        double best = 0;
+        for (int k = 0; k < 3; k++) {
+          double r = rate(s, which);
+          if (r > best) { best = r; }
+        }
+        printf(" %10.1f", best);
+        fflush(stdout);
+      }
+      printf("\n");
+      free(s);
+    }
+  }
+  printf("(MB/s, best of three)\n");
+  return 0;
+}
@@ -0,0 +1,77 @@
+/* Structural scan: GB/s classifying input into bracket, space and */
+/* line masks, a byte at a time against the SWAR and AVX2 kernels */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#define SIZE (16 << 20)
+
+/* Brackets, spaces and lines counted a byte at a time */
+void count_bytes(const char* s, long n, long* counts) {
+  for (long i = 0; i < n; i++) {
+    int c = LREAD_CLASS(s[i]);
+    counts[0] += c == LREAD_OPEN;
+    counts[1] += c == LREAD_CLOSE;
+    counts[2] += c == LREAD_SPACE;
+    counts[3] += s[i] == '\n';
+  }
+}
+
+/* The same from the masks of kernel */
+void count_masks(void (*kernel)(const char*, lmask*), const char* s, long n,
+                 long* counts) {
+  for (long i = 0; i < n; i += 64) {
+    lmask m;
+    kernel(s + i, &m);
+    counts[0] += __builtin_popcountll(m.open);
+    counts[1] += __builtin_popcountll(m.close);
+    counts[2] += __builtin_popcountll(m.space);
+    counts[3] += __builtin_popcountll(m.line);
+  }
+}
+
+int main(void) {
+  jlisp_isolate_del(jlisp_isolate_new());
+  
+  /* Source-like bytes: mostly atoms, with brackets and spacing */
+  const char* alphabet = "(){}    \n0123456789abcdefghij+-*";
+  char* s = malloc(SIZE + 64);
+  uint64_t seed = 88172645463325252ull;
+  for (long i = 0; i < SIZE; i++) {
+    seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+    s[i] = alphabet[seed % 31];
+  }
+  s[SIZE] = '\0';
+  
+  const char* names[] = { "bytes", "SWAR", "AVX2" };
+  void (*kernels[])(const char*, lmask*) = { NULL, lmask_block, NULL };
+#ifdef LVEC_AVX2
+  if (__builtin_cpu_supports("avx2")) { kernels[2] = lmask_block_avx2; }
+#endif
+  
+  long want[4] = { 0 };
+  for (int k = 0; k < 3; k++) {
+    if (k == 2 && !kernels[2]) { printf("%-6s not supported\n", names[k]); continue; }
+    double best = 1e9;
+    long counts[4];
+    for (int r = 0; r < 5; r++) {
+      memset(counts, 0, sizeof(counts));
+      double t0 = now();
+      if (k == 0) { count_bytes(s, SIZE, counts); }
+      else { count_masks(kernels[k], s, SIZE, counts); }
+      double t = now() - t0;
+      if (t < best) { best = t; }
+    }
+    if (k == 0) { memcpy(want, counts, sizeof(want)); }
+    printf("%-6s %8.2f GB/s%s\n", names[k], SIZE / best * 1e-9,
+      memcmp(want, counts, sizeof(want)) ? "  (masks differ)" : "");
+  }
+  free(s);
+  return 0;
+}
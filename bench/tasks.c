@@ -0,0 +1,64 @@
+/* Tasks: 100k tasks alive at once, each yielding a number of times. */
+/* Gives the time to spawn and to run each, and the memory each holds */
+/* while waiting to run */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Resident memory now, in KB */
+long resident_kb(void) {
+  long pages = 0, resident = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) { resident = 0; }
+    fclose(f);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+#define N 100000
+
+int main(void) {
+  jlisp_isolate* iso = jlisp_isolate_new();
+  lval** ts = malloc(sizeof(lval*) * N);
+  
+  printf("%d threads, %d tasks\n", lpool_size(), N);
+  printf("%-8s %12s %12s %12s\n", "yields", "spawn us", "run us", "KB/task");
+  for (int yields = 0; yields <= 16; yields = yields ? yields * 4 : 1) {
+    char prog[256];
+    char* p = prog + sprintf(prog, "spawn {list");
+    for (int i = 0; i < yields; i++) { p += sprintf(p, " (yield {})"); }
+    sprintf(p, " 1}");
+    char* err;
+    lval* tmpl = jlisp_read("bench", prog, &err);
+    
+    /* Every task is spawned before any is awaited */
+    long kb = resident_kb();
+    double t0 = now();
+    for (int i = 0; i < N; i++) { ts[i] = lval_eval(iso->env, lval_copy(tmpl)); }
+    double t1 = now();
+    long held = resident_kb() - kb;
+    
+    long ok = 0;
+    for (int i = 0; i < N; i++) {
+      lval* r = builtin_await(iso->env, lval_add(lval_sexpr(), ts[i]));
+      ok += r->type == LVAL_QEXPR;
+      lval_del(r);
+    }
+    double t2 = now();
+    lval_del(tmpl);
+    
+    printf("%-8d %12.2f %12.2f %12.2f%s\n", yields, (t1 - t0) / N * 1e6,
+      (t2 - t1) / N * 1e6, (double)held / N, ok == N ? "" : " (tasks failed)");
+  }
+  
+  free(ts);
+  jlisp_isolate_del(iso);
+  return 0;
+}
@@ -0,0 +1,48 @@
+/* Vector kernels: elements per nanosecond for the scalar kernels */
+/* against the installed ones (AVX2 where the CPU has it) */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Repeat call over n elements for 0.2s, setting out to elements per ns */
+#define RATE(out, call) do { \
+  long done = 0; double t0 = now(), t; \
+  do { for (int k = 0; k < 16; k++) { call; } done += 16L * n; } \
+  while ((t = now() - t0) < 0.2); \
+  out = done / t * 1e-9; \
+} while (0)
+
+#define ROW(name, scalar, installed) do { \
+  double x, y; \
+  RATE(x, scalar); \
+  RATE(y, installed); \
+  printf("%-10s %8d %10.2f %10.2f\n", name, n, x, y); \
+} while (0)
+
+int main(void) {
+  jlisp_isolate_del(jlisp_isolate_new());
+  
+  printf("%-10s %8s %10s %10s\n", "kernel", "n", "scalar", "installed");
+  for (int n = 1024; n <= 4 << 20; n *= 64) {
+    lnum* a = malloc(sizeof(lnum) * n);
+    lnum* b = malloc(sizeof(lnum) * n);
+    lnum* r = malloc(sizeof(lnum) * n);
+    lnum s;
+    for (int i = 0; i < n; i++) { a[i].i = i * 7 - n; b[i].i = n - i; }
+    ROW("vsum int", lvec_sum_i(&s, a, n), lvec_reducers[0][LVEC_ADD](&s, a, n));
+    ROW("v+ int", lvec_add_i(r, a, b, n), lvec_kernels[0][LVEC_ADD](r, a, b, n));
+    ROW("vmax int", lvec_max_i(&s, a, n), lvec_reducers[0][LVEC_GT](&s, a, n));
+    for (int i = 0; i < n; i++) { a[i].d = i * 0.5; b[i].d = n - i; }
+    ROW("vsum dbl", lvec_sum_d(&s, a, n), lvec_reducers[1][LVEC_ADD](&s, a, n));
+    ROW("v* dbl", lvec_mul_d(r, a, b, n), lvec_kernels[1][LVEC_MUL](r, a, b, n));
+    free(a); free(b); free(r);
+  }
+  printf("(elements per ns)\n");
+  return 0;
+}
@@ -1,6 +1,30 @@
-/* cc -std=c99 -Wall *.c -o parsing */
+/* cc -std=c99 -Wall *.c -pthread -o parsing */
+#define _POSIX_C_SOURCE 200809L
 #include "parsing.h"
 #include "mpc.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* The event loop uses epoll where there is one, and poll elsewhere */
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define LIO_EPOLL 1
+#endif
+
+/* main ignores SIGPIPE anyway where send can't be told to */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 /* If compiling on windows */
 #ifdef _WIN32
@@ -38,22 +62,885 @@ typedef struct lval lval;
 typedef struct lenv lenv;
 
 
+/* Where values are printed. Each thread can point it elsewhere, */
+/* NULL meaning stdout */
+__thread FILE* lval_out = NULL;
+#define LOUT (lval_out ? lval_out : stdout)
+
+/* Lists up to this long keep their cells inside the lval itself */
+#define LVAL_SMALL 4
+
+/* Values can be shared between pmap workers, so every reference */
+/* count is changed atomically */
+#define LREF_INC(r) __atomic_add_fetch(&(r), 1, __ATOMIC_RELAXED)
+#define LREF_DEC(r) __atomic_sub_fetch(&(r), 1, __ATOMIC_ACQ_REL)
+#define LREF_GET(r) __atomic_load_n(&(r), __ATOMIC_ACQUIRE)
+
+/* Fuel left for the evaluation on this thread. Every step burns one */
+/* and allocations burn one per cell or element, see lmachine_run */
+__thread long lfuel = LONG_MAX;
+
+/* What each evaluation on this thread starts with, 0 for no limit */
+__thread long lfuel_limit = 0;
+#define LFUEL_BURN(n) (lfuel -= (n))
+
+/* Start an evaluation on this thread with limit as its fuel */
+void lfuel_fill(long limit) {
+  lfuel_limit = limit;
+  lfuel = limit ? limit : LONG_MAX;
+}
+
 /* Create Enumeration of Possible lval Types */
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+       LVAL_PAIR, LVAL_BIG, LVAL_DBL, LVAL_VEC, LVAL_MAT, LVAL_FUT,
+       LVAL_CHAN, LVAL_ROPE };
+
+/* Bignums */
+
+/* Integers too big for a long are kept as base 10^9 digits, least */
+/* significant first. Base 10^9 makes reading and printing linear */
+#define LBIG_BASE 1000000000u
+#define LBIG_KARATSUBA 32 /* digits below which schoolbook is faster */
+
+typedef struct lbig {
+  int neg;
+  int len; /* no leading zero digits, zero is a single 0 digit */
+  uint32_t d[];
+} lbig;
+
+lbig* lbig_new(int len) {
+  LFUEL_BURN(len);
+  lbig* b = calloc(1, sizeof(lbig) + sizeof(uint32_t) * len);
+  b->len = len;
+  return b;
+}
+
+lbig* lbig_trim(lbig* b) {
+  while (b->len > 1 && b->d[b->len-1] == 0) { b->len--; }
+  if (b->len == 1 && b->d[0] == 0) { b->neg = 0; }
+  return b;
+}
+
+lbig* lbig_from_long(long x) {
+  lbig* b = lbig_new(3);
+  b->neg = x < 0;
+  
+  /* Negate as unsigned so LONG_MIN doesn't overflow */
+  unsigned long m = x < 0 ? -(unsigned long)x : (unsigned long)x;
+  for (int i = 0; i < 3; i++) {
+    b->d[i] = m % LBIG_BASE;
+    m /= LBIG_BASE;
+  }
+  return lbig_trim(b);
+}
+
+/* Store b in *x if it fits in a long */
+int lbig_to_long(lbig* b, long* x) {
+  if (b->len > 3) { return 0; }
+  
+  unsigned long m = 0;
+  for (int i = b->len-1; i >= 0; i--) {
+    if (__builtin_mul_overflow(m, LBIG_BASE, &m)
+      || __builtin_add_overflow(m, b->d[i], &m)) { return 0; }
+  }
+  
+  if (!b->neg && m <= LONG_MAX) { *x = (long)m; return 1; }
+  if (b->neg && m <= (unsigned long)LONG_MAX + 1) { *x = (long)-m; return 1; }
+  return 0;
+}
+
+/* Read a string of decimal digits with an optional leading '-' */
+lbig* lbig_read(char* s) {
+  int neg = *s == '-';
+  if (neg) { s++; }
+  
+  int n = strlen(s);
+  lbig* b = lbig_new((n + 8) / 9);
+  b->neg = neg;
+  
+  /* Each digit takes nine characters, counting back from the end */
+  for (int i = 0; i < b->len; i++) {
+    int end = n - 9*i;
+    int start = end > 9 ? end - 9 : 0;
+    uint32_t d = 0;
+    for (int j = start; j < end; j++) { d = d*10 + (s[j] - '0'); }
+    b->d[i] = d;
+  }
+  return lbig_trim(b);
+}
+
+void lbig_print(lbig* b) {
+  if (b->neg) { fputc('-', LOUT); }
+  fprintf(LOUT, "%u", b->d[b->len-1]);
+  for (int i = b->len-2; i >= 0; i--) { fprintf(LOUT, "%09u", b->d[i]); }
+}
+
+/* Goes through the decimal digits so strtod can round correctly */
+double lbig_to_double(lbig* b) {
+  char* buf = malloc(b->len * 9 + 2);
+  char* p = buf;
+  if (b->neg) { *p++ = '-'; }
+  p += sprintf(p, "%u", b->d[b->len-1]);
+  for (int i = b->len-2; i >= 0; i--) { p += sprintf(p, "%09u", b->d[i]); }
+  
+  double x = strtod(buf, NULL);
+  free(buf);
+  return x;
+}
+
+lbig* lbig_copy(lbig* b) {
+  size_t size = sizeof(lbig) + sizeof(uint32_t) * b->len;
+  lbig* c = malloc(size);
+  memcpy(c, b, size);
+  return c;
+}
+
+/* The functions below work on magnitudes, as arrays of digits with */
+/* their lengths, and ignore sign */
+
+int lbig_cmp_mag(uint32_t* a, int an, uint32_t* b, int bn) {
+  if (an != bn) { return an < bn ? -1 : 1; }
+  for (int i = an-1; i >= 0; i--) {
+    if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+  }
+  return 0;
+}
+
+/* r += a, where r has room for any carry out of a */
+void lbig_add_into(uint32_t* r, uint32_t* a, int an) {
+  uint32_t carry = 0;
+  for (int i = 0; i < an || carry; i++) {
+    uint32_t s = r[i] + (i < an ? a[i] : 0) + carry;
+    carry = s >= LBIG_BASE;
+    r[i] = carry ? s - LBIG_BASE : s;
+  }
+}
+
+/* r -= a, where r is at least as big as a */
+void lbig_sub_into(uint32_t* r, uint32_t* a, int an) {
+  uint32_t borrow = 0;
+  for (int i = 0; i < an || borrow; i++) {
+    uint32_t s = (i < an ? a[i] : 0) + borrow;
+    borrow = r[i] < s;
+    r[i] = borrow ? r[i] + LBIG_BASE - s : r[i] - s;
+  }
+}
+
+int lbig_len(uint32_t* a, int an) {
+  while (an > 1 && a[an-1] == 0) { an--; }
+  return an;
+}
+
+/* r = a * b, r has an+bn digits and starts zeroed */
+void lbig_mul_school(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn) {
+  for (int i = 0; i < an; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < bn; j++) {
+      uint64_t t = r[i+j] + (uint64_t)a[i] * b[j] + carry;
+      r[i+j] = t % LBIG_BASE;
+      carry = t / LBIG_BASE;
+    }
+    r[i+bn] = carry;
+  }
+}
+
+/* r = a * b, r has an+bn digits and starts zeroed. Karatsuba splits */
+/* each side in two at m and gets by with three half-size products */
+void lbig_mul_mag(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn) {
+  if (an < bn) {
+    uint32_t* t = a; a = b; b = t;
+    int tn = an; an = bn; bn = tn;
+  }
+  
+  /* Lopsided products don't split evenly, so leave them to schoolbook */
+  if (bn < LBIG_KARATSUBA || bn*2 <= an) {
+    lbig_mul_school(r, a, an, b, bn);
+    return;
+  }
+  
+  int m = an / 2;
+  uint32_t *a0 = a, *a1 = a + m, *b0 = b, *b1 = b + m;
+  int a1n = an - m, b1n = bn - m;
+  
+  /* z0 = a0*b0 and z2 = a1*b1 go straight into their places in r */
+  lbig_mul_mag(r, a0, m, b0, m);
+  lbig_mul_mag(r + 2*m, a1, a1n, b1, b1n);
+  
+  /* z1 = (a0+a1)(b0+b1) - z0 - z2 */
+  int sn = a1n + 1, tn = (b1n > m ? b1n : m) + 1;
+  uint32_t* s = calloc(sn + tn + sn + tn, sizeof(uint32_t));
+  uint32_t* t = s + sn;
+  uint32_t* z1 = t + tn;
+  memcpy(s, a1, sizeof(uint32_t) * a1n);
+  lbig_add_into(s, a0, m);
+  memcpy(t, b1, sizeof(uint32_t) * b1n);
+  lbig_add_into(t, b0, m);
+  sn = lbig_len(s, sn);
+  tn = lbig_len(t, tn);
+  
+  lbig_mul_mag(z1, s, sn, t, tn);
+  lbig_sub_into(z1, r, lbig_len(r, 2*m));
+  lbig_sub_into(z1, r + 2*m, lbig_len(r + 2*m, a1n + b1n));
+  
+  lbig_add_into(r + m, z1, lbig_len(z1, sn + tn));
+  free(s);
+}
+
+/* q = u / v by long division (Knuth's algorithm D), q has un-vn+1 */
+/* digits and starts zeroed, u must be at least as big as v */
+void lbig_div_mag(uint32_t* q, uint32_t* u, int un, uint32_t* v, int vn) {
+  if (vn == 1) {
+    uint64_t rem = 0;
+    for (int i = un-1; i >= 0; i--) {
+      uint64_t cur = rem * LBIG_BASE + u[i];
+      q[i] = cur / v[0];
+      rem = cur % v[0];
+    }
+    return;
+  }
+  
+  /* Scale both sides so the top digit of v is at least half the base, */
+  /* which keeps each estimated quotient digit within two of the truth */
+  uint32_t f = LBIG_BASE / (v[vn-1] + 1);
+  uint32_t* w = calloc(un + 1 + vn + 1, sizeof(uint32_t));
+  uint32_t* y = w + un + 1;
+  lbig_mul_school(w, u, un, &f, 1);
+  lbig_mul_school(y, v, vn, &f, 1);
+  
+  for (int j = un - vn; j >= 0; j--) {
+    uint64_t top = (uint64_t)w[j+vn] * LBIG_BASE + w[j+vn-1];
+    uint64_t qhat = top / y[vn-1];
+    uint64_t rhat = top % y[vn-1];
+    while (qhat >= LBIG_BASE
+      || qhat * y[vn-2] > rhat * LBIG_BASE + w[j+vn-2]) {
+      qhat--;
+      rhat += y[vn-1];
+      if (rhat >= LBIG_BASE) { break; }
+    }
+    
+    /* w[j..j+vn] -= qhat * y */
+    uint64_t carry = 0;
+    int64_t borrow = 0;
+    for (int i = 0; i < vn; i++) {
+      uint64_t p = qhat * y[i] + carry;
+      carry = p / LBIG_BASE;
+      int64_t t = (int64_t)w[i+j] - (int64_t)(p % LBIG_BASE) - borrow;
+      borrow = t < 0;
+      w[i+j] = borrow ? t + LBIG_BASE : t;
+    }
+    int64_t t = (int64_t)w[j+vn] - (int64_t)carry - borrow;
+    w[j+vn] = t < 0 ? t + LBIG_BASE : t;
+    
+    /* Estimate was one too many, so add y back */
+    if (t < 0) {
+      qhat--;
+      uint32_t c = 0;
+      for (int i = 0; i < vn; i++) {
+        uint32_t s = w[i+j] + y[i] + c;
+        c = s >= LBIG_BASE;
+        w[i+j] = c ? s - LBIG_BASE : s;
+      }
+      w[j+vn] = (w[j+vn] + c) % LBIG_BASE;
+    }
+    q[j] = qhat;
+  }
+  free(w);
+}
+
+/* Signed operations, each returning a new bignum */
+
+/* a + b, with b taken to have sign bneg so this does subtraction too */
+lbig* lbig_add(lbig* a, lbig* b, int bneg) {
+  int aneg = a->neg;
+  
+  if (aneg == bneg) {
+    lbig* r = lbig_new((a->len > b->len ? a->len : b->len) + 1);
+    memcpy(r->d, a->d, sizeof(uint32_t) * a->len);
+    lbig_add_into(r->d, b->d, b->len);
+    r->neg = aneg;
+    return lbig_trim(r);
+  }
+  
+  /* Signs differ, so take the smaller magnitude from the bigger */
+  if (lbig_cmp_mag(a->d, a->len, b->d, b->len) < 0) {
+    lbig* t = a; a = b; b = t;
+    aneg = bneg;
+  }
+  lbig* r = lbig_new(a->len);
+  memcpy(r->d, a->d, sizeof(uint32_t) * a->len);
+  lbig_sub_into(r->d, b->d, b->len);
+  r->neg = aneg;
+  return lbig_trim(r);
+}
+
+lbig* lbig_mul(lbig* a, lbig* b) {
+  lbig* r = lbig_new(a->len + b->len);
+  lbig_mul_mag(r->d, a->d, a->len, b->d, b->len);
+  r->neg = a->neg ^ b->neg;
+  return lbig_trim(r);
+}
+
+/* a / b rounded toward zero like C division, b must not be zero */
+lbig* lbig_div(lbig* a, lbig* b) {
+  if (lbig_cmp_mag(a->d, a->len, b->d, b->len) < 0) { return lbig_new(1); }
+  
+  lbig* q = lbig_new(a->len - b->len + 1);
+  lbig_div_mag(q->d, a->d, a->len, b->d, b->len);
+  q->neg = a->neg ^ b->neg;
+  return lbig_trim(q);
+}
+
+
+/* Vectors */
+
+/* LVAL_VEC keeps its numbers unboxed in one block, all int64_t or all */
+/* double, so element-wise maths can run through the SIMD kernels below */
+typedef union lnum {
+  int64_t i;
+  double d;
+} lnum;
+
+typedef struct lvec {
+  int dbl; /* elements are doubles, otherwise int64_t */
+  int len;
+  lnum e[];
+} lvec;
+
+lvec* lvec_new(int dbl, int len) {
+  LFUEL_BURN(len);
+  lvec* v = malloc(sizeof(lvec) + sizeof(lnum) * len);
+  v->dbl = dbl;
+  v->len = len;
+  return v;
+}
+
+/* Kernels return one of these */
+enum { LVEC_OK, LVEC_OVERFLOW, LVEC_DIV_ZERO };
+
+enum { LVEC_ADD, LVEC_SUB, LVEC_MUL, LVEC_DIV, LVEC_LT, LVEC_GT, LVEC_EQ,
+       LVEC_NOPS };
+
+/* r = a op b element-wise, r may be a or b */
+typedef int (*lvec_kernel)(lnum* r, lnum* a, lnum* b, int n);
+
+/* Reduce a to one number, op is LVEC_ADD for the sum or LVEC_LT/GT */
+/* for the minimum/maximum */
+typedef int (*lvec_reducer)(lnum* r, lnum* a, int n);
+
+/* Scalar kernels, which also finish off the tail of the SIMD ones */
+
+#define LVEC_DBL_SCALAR(name, expr) \
+  int name(lnum* r, lnum* a, lnum* b, int n) { \
+    for (int i = 0; i < n; i++) { \
+      double x = a[i].d, y = b[i].d; \
+      r[i].d = (expr); \
+    } \
+    return LVEC_OK; \
+  }
+
+LVEC_DBL_SCALAR(lvec_add_d, x + y)
+LVEC_DBL_SCALAR(lvec_sub_d, x - y)
+LVEC_DBL_SCALAR(lvec_mul_d, x * y)
+
+/* A zero divisor is an error, as it is for / on plain doubles */
+int lvec_div_d(lnum* r, lnum* a, lnum* b, int n) {
+  for (int i = 0; i < n; i++) {
+    if (b[i].d == 0) { return LVEC_DIV_ZERO; }
+    r[i].d = a[i].d / b[i].d;
+  }
+  return LVEC_OK;
+}
+
+/* Comparisons write 0 or 1 as int64_t, even for doubles */
+#define LVEC_CMP_SCALAR(name, field, cmp) \
+  int name(lnum* r, lnum* a, lnum* b, int n) { \
+    for (int i = 0; i < n; i++) { r[i].i = a[i].field cmp b[i].field; } \
+    return LVEC_OK; \
+  }
+
+LVEC_CMP_SCALAR(lvec_lt_d, d, <)
+LVEC_CMP_SCALAR(lvec_gt_d, d, >)
+LVEC_CMP_SCALAR(lvec_eq_d, d, ==)
+LVEC_CMP_SCALAR(lvec_lt_i, i, <)
+LVEC_CMP_SCALAR(lvec_gt_i, i, >)
+LVEC_CMP_SCALAR(lvec_eq_i, i, ==)
+
+#define LVEC_INT_SCALAR(name, builtin) \
+  int name(lnum* r, lnum* a, lnum* b, int n) { \
+    for (int i = 0; i < n; i++) { \
+      if (builtin(a[i].i, b[i].i, &r[i].i)) { return LVEC_OVERFLOW; } \
+    } \
+    return LVEC_OK; \
+  }
+
+LVEC_INT_SCALAR(lvec_add_i, __builtin_add_overflow)
+LVEC_INT_SCALAR(lvec_sub_i, __builtin_sub_overflow)
+LVEC_INT_SCALAR(lvec_mul_i, __builtin_mul_overflow)
+
+/* There's no SIMD integer division on x86, so this one is always scalar */
+int lvec_div_i(lnum* r, lnum* a, lnum* b, int n) {
+  for (int i = 0; i < n; i++) {
+    if (b[i].i == 0) { return LVEC_DIV_ZERO; }
+    if (a[i].i == INT64_MIN && b[i].i == -1) { return LVEC_OVERFLOW; }
+    r[i].i = a[i].i / b[i].i;
+  }
+  return LVEC_OK;
+}
+
+int lvec_sum_d(lnum* r, lnum* a, int n) {
+  double s = 0;
+  for (int i = 0; i < n; i++) { s += a[i].d; }
+  r->d = s;
+  return LVEC_OK;
+}
+
+/* Add a to s letting it wrap, and count the wraps in *hi, so the exact */
+/* total is s + *hi * 2^64. Only a total out of range is an overflow, */
+/* whatever order the numbers are added in */
+int64_t lvec_sum_carry(int64_t s, long* hi, lnum* a, int n) {
+  for (int i = 0; i < n; i++) {
+    if (__builtin_add_overflow(s, a[i].i, &s)) { *hi += a[i].i < 0 ? -1 : 1; }
+  }
+  return s;
+}
+
+int lvec_sum_i(lnum* r, lnum* a, int n) {
+  long hi = 0;
+  int64_t s = lvec_sum_carry(0, &hi, a, n);
+  if (hi) { return LVEC_OVERFLOW; }
+  r->i = s;
+  return LVEC_OK;
+}
+
+#define LVEC_PICK_SCALAR(name, field, cmp) \
+  int name(lnum* r, lnum* a, int n) { \
+    lnum m = a[0]; \
+    for (int i = 1; i < n; i++) { if (a[i].field cmp m.field) { m = a[i]; } } \
+    *r = m; \
+    return LVEC_OK; \
+  }
+
+LVEC_PICK_SCALAR(lvec_min_d, d, <)
+LVEC_PICK_SCALAR(lvec_max_d, d, >)
+LVEC_PICK_SCALAR(lvec_min_i, i, <)
+LVEC_PICK_SCALAR(lvec_max_i, i, >)
+
+/* AVX2 kernels. They're compiled for AVX2 whatever the build flags, */
+/* and only installed by lvec_init if the CPU turns out to have it */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LVEC_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+
+#define LVEC_DBL_AVX2(name, vop, tail) \
+  LVEC_AVX2 int name##_avx2(lnum* r, lnum* a, lnum* b, int n) { \
+    int i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+      __m256d x = _mm256_loadu_pd(&a[i].d); \
+      __m256d y = _mm256_loadu_pd(&b[i].d); \
+      _mm256_storeu_pd(&r[i].d, vop(x, y)); \
+    } \
+    return tail(r+i, a+i, b+i, n-i); \
+  }
+
+LVEC_DBL_AVX2(lvec_add_d, _mm256_add_pd, lvec_add_d)
+LVEC_DBL_AVX2(lvec_sub_d, _mm256_sub_pd, lvec_sub_d)
+LVEC_DBL_AVX2(lvec_mul_d, _mm256_mul_pd, lvec_mul_d)
+
+/* Zero divisor lanes are gathered into one mask, checked at the end */
+LVEC_AVX2 int lvec_div_d_avx2(lnum* r, lnum* a, lnum* b, int n) {
+  __m256d zero = _mm256_setzero_pd(), any = zero;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d y = _mm256_loadu_pd(&b[i].d);
+    any = _mm256_or_pd(any, _mm256_cmp_pd(y, zero, _CMP_EQ_OQ));
+    _mm256_storeu_pd(&r[i].d, _mm256_div_pd(_mm256_loadu_pd(&a[i].d), y));
+  }
+  if (_mm256_movemask_pd(any)) { return LVEC_DIV_ZERO; }
+  return lvec_div_d(r+i, a+i, b+i, n-i);
+}
+
+/* Comparison masks are all ones or all zeros, so masking with 1 */
+/* leaves the 0 or 1 result in each lane */
+#define LVEC_CMP_AVX2(name, load, cmp, tail) \
+  LVEC_AVX2 int name##_avx2(lnum* r, lnum* a, lnum* b, int n) { \
+    __m256i one = _mm256_set1_epi64x(1); \
+    int i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+      __m256i m = cmp(load(a+i), load(b+i)); \
+      _mm256_storeu_si256((__m256i*)&r[i], _mm256_and_si256(m, one)); \
+    } \
+    return tail(r+i, a+i, b+i, n-i); \
+  }
+
+#define LVEC_LOAD_D(p) _mm256_loadu_pd(&(p)->d)
+#define LVEC_LOAD_I(p) _mm256_loadu_si256((__m256i*)(p))
+#define LVEC_LT_D(x, y) _mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_LT_OQ))
+#define LVEC_GT_D(x, y) _mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_GT_OQ))
+#define LVEC_EQ_D(x, y) _mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_EQ_OQ))
+#define LVEC_LT_I(x, y) _mm256_cmpgt_epi64(y, x)
+
+LVEC_CMP_AVX2(lvec_lt_d, LVEC_LOAD_D, LVEC_LT_D, lvec_lt_d)
+LVEC_CMP_AVX2(lvec_gt_d, LVEC_LOAD_D, LVEC_GT_D, lvec_gt_d)
+LVEC_CMP_AVX2(lvec_eq_d, LVEC_LOAD_D, LVEC_EQ_D, lvec_eq_d)
+LVEC_CMP_AVX2(lvec_lt_i, LVEC_LOAD_I, LVEC_LT_I, lvec_lt_i)
+LVEC_CMP_AVX2(lvec_gt_i, LVEC_LOAD_I, _mm256_cmpgt_epi64, lvec_gt_i)
+LVEC_CMP_AVX2(lvec_eq_i, LVEC_LOAD_I, _mm256_cmpeq_epi64, lvec_eq_i)
+
+/* Integer add and subtract wrap in the vector unit, so overflow is */
+/* spotted afterwards from the signs: a lane overflowed if its result */
+/* has a different sign from both inputs (for add), or from a but not */
+/* b (for subtract). The sign bits are collected and checked once */
+LVEC_AVX2 int lvec_add_i_avx2(lnum* r, lnum* a, lnum* b, int n) {
+  __m256i bad = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = LVEC_LOAD_I(a+i), y = LVEC_LOAD_I(b+i);
+    __m256i s = _mm256_add_epi64(x, y);
+    bad = _mm256_or_si256(bad, _mm256_and_si256(_mm256_xor_si256(x, s),
+                                                 _mm256_xor_si256(y, s)));
+    _mm256_storeu_si256((__m256i*)&r[i], s);
+  }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(bad))) { return LVEC_OVERFLOW; }
+  return lvec_add_i(r+i, a+i, b+i, n-i);
+}
+
+LVEC_AVX2 int lvec_sub_i_avx2(lnum* r, lnum* a, lnum* b, int n) {
+  __m256i bad = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = LVEC_LOAD_I(a+i), y = LVEC_LOAD_I(b+i);
+    __m256i s = _mm256_sub_epi64(x, y);
+    bad = _mm256_or_si256(bad, _mm256_and_si256(_mm256_xor_si256(x, s),
+                                                 _mm256_xor_si256(x, y)));
+    _mm256_storeu_si256((__m256i*)&r[i], s);
+  }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(bad))) { return LVEC_OVERFLOW; }
+  return lvec_sub_i(r+i, a+i, b+i, n-i);
+}
+
+/* Reductions keep four running lanes and combine them at the end */
+LVEC_AVX2 int lvec_sum_d_avx2(lnum* r, lnum* a, int n) {
+  __m256d s = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) { s = _mm256_add_pd(s, LVEC_LOAD_D(a+i)); }
+  
+  double lanes[4];
+  _mm256_storeu_pd(lanes, s);
+  lvec_sum_d(r, a+i, n-i);
+  r->d += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  return LVEC_OK;
+}
+
+/* Each lane counts its own wraps like lvec_sum_carry: a lane wrapped */
+/* if its total changed sign against both inputs, upwards if x was */
+/* positive. The lanes and counts are then added up exactly */
+LVEC_AVX2 int lvec_sum_i_avx2(lnum* r, lnum* a, int n) {
+  __m256i s = _mm256_setzero_si256();
+  __m256i hi = _mm256_setzero_si256();
+  __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi64x(1);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = LVEC_LOAD_I(a+i);
+    __m256i t = _mm256_add_epi64(s, x);
+    __m256i wrap = _mm256_cmpgt_epi64(zero, _mm256_and_si256(
+      _mm256_xor_si256(s, t), _mm256_xor_si256(x, t)));
+    __m256i dir = _mm256_or_si256(_mm256_cmpgt_epi64(zero, x), one);
+    hi = _mm256_add_epi64(hi, _mm256_and_si256(wrap, dir));
+    s = t;
+  }
+  
+  lnum lanes[4], his[4];
+  _mm256_storeu_si256((__m256i*)lanes, s);
+  _mm256_storeu_si256((__m256i*)his, hi);
+  long h = his[0].i + his[1].i + his[2].i + his[3].i;
+  int64_t t = lvec_sum_carry(0, &h, lanes, 4);
+  t = lvec_sum_carry(t, &h, a+i, n-i);
+  if (h) { return LVEC_OVERFLOW; }
+  r->i = t;
+  return LVEC_OK;
+}
+
+#define LVEC_PICK_AVX2(name, load, vpick, tail) \
+  LVEC_AVX2 int name##_avx2(lnum* r, lnum* a, int n) { \
+    if (n < 8) { return tail(r, a, n); } \
+    __typeof__(load(a)) m = load(a); \
+    int i = 4; \
+    for (; i + 4 <= n; i += 4) { m = vpick(m, load(a+i)); } \
+    lnum lanes[5]; \
+    _mm256_storeu_si256((__m256i*)lanes, (__m256i)m); \
+    tail(&lanes[4], a+i-4, n-i+4); \
+    return tail(r, lanes, 5); \
+  }
+
+#define LVEC_MIN_I(x, y) _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(x, y))
+#define LVEC_MAX_I(x, y) _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(y, x))
+
+LVEC_PICK_AVX2(lvec_min_d, LVEC_LOAD_D, _mm256_min_pd, lvec_min_d)
+LVEC_PICK_AVX2(lvec_max_d, LVEC_LOAD_D, _mm256_max_pd, lvec_max_d)
+LVEC_PICK_AVX2(lvec_min_i, LVEC_LOAD_I, LVEC_MIN_I, lvec_min_i)
+LVEC_PICK_AVX2(lvec_max_i, LVEC_LOAD_I, LVEC_MAX_I, lvec_max_i)
+#endif
+
+/* Kernels in use, by [dbl][op]. Scalar until lvec_init finds AVX2 */
+lvec_kernel lvec_kernels[2][LVEC_NOPS] = {
+  { lvec_add_i, lvec_sub_i, lvec_mul_i, lvec_div_i,
+    lvec_lt_i, lvec_gt_i, lvec_eq_i },
+  { lvec_add_d, lvec_sub_d, lvec_mul_d, lvec_div_d,
+    lvec_lt_d, lvec_gt_d, lvec_eq_d },
+};
+
+lvec_reducer lvec_reducers[2][LVEC_NOPS] = {
+  { [LVEC_ADD] = lvec_sum_i, [LVEC_LT] = lvec_min_i, [LVEC_GT] = lvec_max_i },
+  { [LVEC_ADD] = lvec_sum_d, [LVEC_LT] = lvec_min_d, [LVEC_GT] = lvec_max_d },
+};
+
+void lvec_init(void) {
+#ifdef LVEC_AVX2
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2")) { return; }
+  
+  lvec_kernel avx2[2][LVEC_NOPS] = {
+    { lvec_add_i_avx2, lvec_sub_i_avx2, lvec_mul_i, lvec_div_i,
+      lvec_lt_i_avx2, lvec_gt_i_avx2, lvec_eq_i_avx2 },
+    { lvec_add_d_avx2, lvec_sub_d_avx2, lvec_mul_d_avx2, lvec_div_d_avx2,
+      lvec_lt_d_avx2, lvec_gt_d_avx2, lvec_eq_d_avx2 },
+  };
+  memcpy(lvec_kernels, avx2, sizeof(avx2));
+  
+  lvec_reducers[0][LVEC_ADD] = lvec_sum_i_avx2;
+  lvec_reducers[0][LVEC_LT] = lvec_min_i_avx2;
+  lvec_reducers[0][LVEC_GT] = lvec_max_i_avx2;
+  lvec_reducers[1][LVEC_ADD] = lvec_sum_d_avx2;
+  lvec_reducers[1][LVEC_LT] = lvec_min_d_avx2;
+  lvec_reducers[1][LVEC_GT] = lvec_max_d_avx2;
+#endif
+}
+
+/* Matrices */
+
+/* LVAL_MAT is a 2-D view onto a reference counted block of doubles. */
+/* Element (i, j) lives at at[i*rs + j*cs], so transposes and slices are */
+/* new views of the same block rather than copies */
+typedef struct lmatbuf {
+  int refs;
+  double d[];
+} lmatbuf;
+
+typedef struct lmat {
+  lmatbuf* buf;
+  double* at;
+  int rows, cols;
+  long rs, cs; /* row and column strides */
+} lmat;
+
+/* A new row-major matrix with its own zeroed block */
+lmat* lmat_new(int rows, int cols) {
+  LFUEL_BURN((long)rows * cols);
+  lmat* m = malloc(sizeof(lmat));
+  m->buf = calloc(1, sizeof(lmatbuf) + sizeof(double) * rows * cols);
+  m->buf->refs = 1;
+  m->at = m->buf->d;
+  m->rows = rows;
+  m->cols = cols;
+  m->rs = cols;
+  m->cs = 1;
+  return m;
+}
+
+lmat* lmat_view(lmat* m) {
+  lmat* v = malloc(sizeof(lmat));
+  *v = *m;
+  LREF_INC(v->buf->refs);
+  return v;
+}
+
+void lmat_del(lmat* m) {
+  if (LREF_DEC(m->buf->refs) == 0) { free(m->buf); }
+  free(m);
+}
+
+/* Blocking sizes for lmat_mul: an LMAT_KC x LMAT_NC panel of b is packed */
+/* to sit in L2, and LMAT_MC rows of a at a time are packed against it */
+#define LMAT_MC 64
+#define LMAT_KC 256
+#define LMAT_NC 512
+
+/* c[mc x nc] += a[mc x kc] * b[kc x nc], all row-major with the given */
+/* row strides, a and b packed */
+typedef void (*lmat_kernel)(double* c, long ldc, double* a, double* b,
+                            int mc, int nc, int kc);
+
+void lmat_kernel_scalar(double* c, long ldc, double* a, double* b,
+                        int mc, int nc, int kc) {
+  for (int i = 0; i < mc; i++) {
+    for (int p = 0; p < kc; p++) {
+      double x = a[i*kc + p];
+      double* bp = b + (long)p*nc;
+      double* ci = c + i*ldc;
+      for (int j = 0; j < nc; j++) { ci[j] += x * bp[j]; }
+    }
+  }
+}
+
+#ifdef LVEC_AVX2
+/* Works through c in 4 x 8 tiles, holding each tile in eight registers */
+/* while it runs down the whole of kc */
+__attribute__((target("avx2,fma")))
+void lmat_kernel_avx2(double* c, long ldc, double* a, double* b,
+                      int mc, int nc, int kc) {
+  int i = 0;
+  for (; i + 4 <= mc; i += 4) {
+    int j = 0;
+    for (; j + 8 <= nc; j += 8) {
+      __m256d t[4][2];
+      for (int r = 0; r < 4; r++) {
+        t[r][0] = _mm256_loadu_pd(c + (i+r)*ldc + j);
+        t[r][1] = _mm256_loadu_pd(c + (i+r)*ldc + j + 4);
+      }
+      for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_loadu_pd(b + (long)p*nc + j);
+        __m256d b1 = _mm256_loadu_pd(b + (long)p*nc + j + 4);
+        for (int r = 0; r < 4; r++) {
+          __m256d x = _mm256_broadcast_sd(a + (i+r)*kc + p);
+          t[r][0] = _mm256_fmadd_pd(x, b0, t[r][0]);
+          t[r][1] = _mm256_fmadd_pd(x, b1, t[r][1]);
+        }
+      }
+      for (int r = 0; r < 4; r++) {
+        _mm256_storeu_pd(c + (i+r)*ldc + j, t[r][0]);
+        _mm256_storeu_pd(c + (i+r)*ldc + j + 4, t[r][1]);
+      }
+    }
+    
+    /* Columns left over on the right */
+    for (int r = i; r < i + 4; r++) {
+      for (int p = 0; p < kc; p++) {
+        for (int jj = j; jj < nc; jj++) {
+          c[r*ldc + jj] += a[r*kc + p] * b[(long)p*nc + jj];
+        }
+      }
+    }
+  }
+  
+  /* Rows left over at the bottom */
+  lmat_kernel_scalar(c + i*ldc, ldc, a + i*kc, b, mc - i, nc, kc);
+}
+#endif
+
+lmat_kernel lmat_kernel_best = lmat_kernel_scalar;
+
+void lmat_init(void) {
+#ifdef LVEC_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    lmat_kernel_best = lmat_kernel_avx2;
+  }
+#endif
+}
+
+/* Copy a rows x cols block of m starting at (i, j) into dst, row-major. */
+/* This is also what lets the kernel ignore transposed or sliced views */
+void lmat_pack(double* dst, lmat* m, int i, int j, int rows, int cols) {
+  for (int r = 0; r < rows; r++) {
+    double* src = m->at + (i+r)*m->rs + j*m->cs;
+    if (m->cs == 1) {
+      memcpy(dst + (long)r*cols, src, sizeof(double) * cols);
+    } else {
+      for (int k = 0; k < cols; k++) { dst[(long)r*cols + k] = src[k*m->cs]; }
+    }
+  }
+}
+
+/* a * b, blocked so each packed panel is reused from cache */
+lmat* lmat_mul(lmat* a, lmat* b) {
+  lmat* c = lmat_new(a->rows, b->cols);
+  double* pa = malloc(sizeof(double) * LMAT_MC * LMAT_KC);
+  double* pb = malloc(sizeof(double) * LMAT_KC * LMAT_NC);
+  
+  for (int jc = 0; jc < b->cols; jc += LMAT_NC) {
+    int nc = b->cols - jc < LMAT_NC ? b->cols - jc : LMAT_NC;
+    for (int pc = 0; pc < a->cols; pc += LMAT_KC) {
+      int kc = a->cols - pc < LMAT_KC ? a->cols - pc : LMAT_KC;
+      lmat_pack(pb, b, pc, jc, kc, nc);
+      for (int ic = 0; ic < a->rows; ic += LMAT_MC) {
+        int mc = a->rows - ic < LMAT_MC ? a->rows - ic : LMAT_MC;
+        lmat_pack(pa, a, ic, pc, mc, kc);
+        lmat_kernel_best(c->at + (long)ic*c->rs + jc, c->rs, pa, pb,
+                         mc, nc, kc);
+      }
+    }
+  }
+  
+  free(pa);
+  free(pb);
+  return c;
+}
+
+/* Heap cell arrays are reference counted so lval_copy can share them */
+typedef struct lcells {
+  int refs;
+  int lo, hi; /* slots the block owns while shared, lo < 0 when trimmed */
+  lval* slot[];
+} lcells;
+
+/* Cons cell of an LVAL_PAIR list. Tails are shared between lists, */
+/* so each cell counts the lists and cells pointing at it */
+typedef struct lcons {
+  int refs;
+  lval* car;
+  struct lcons* cdr;
+} lcons;
+
+/* Node of an LVAL_ROPE list, a leaf of up to LROPE_LEAF items or a */
+/* branch over two ropes whose heights differ by at most one. Nodes */
+/* never change once built, so lists share them and each counts the */
+/* lists and branches holding it */
+#define LROPE_LEAF 32
+
+typedef struct lrope {
+  int refs;
+  int count;  /* items under the node */
+  int height; /* 0 for a leaf */
+  struct lrope* l;
+  struct lrope* r;
+  lval* item[]; /* the items of a leaf */
+} lrope;
+
+/* Futures are run on the thread pool, see below */
+typedef struct lfut lfut;
+typedef struct lchan lchan;
 
 /*return an lval* by derencing lbuiltin called with lenv* and lval* */
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
-/* Lval struct of either num or error */
+/* Lval struct of either num or error. Only the fields of its type */
+/* are ever set, so they share one union and a number takes no more */
+/* room than its header and a long */
 typedef struct lval {
   int type;
-  long num;
-  char* err; /* Error and Symbol types as strings */
-  char* sym;
-  lbuiltin fun;
-  int count;
-  lval** cell; /* pointer to a list of LVALS */
-  
+  int count; /* items of an S-Expression, Q-Expression, Pair or Rope */
+  union {
+    long num;
+    lbig* big; /* LVAL_BIG, only for integers that don't fit in num */
+    double dbl;
+    lvec* vec;
+    lmat* mat;
+    lfut* fut; /* LVAL_FUT, shared by every copy */
+    lchan* chan; /* LVAL_CHAN, likewise */
+    char* err; /* Error and Symbol types as strings */
+    char* sym;
+    lbuiltin fun;
+    lcons* pair; /* first cons cell of an LVAL_PAIR */
+    lrope* rope; /* root of an LVAL_ROPE, NULL when empty */
+    struct {
+      int cap; /* slots allocated in cell, grows geometrically */
+      int off; /* free slots in front of cell left by popping the head */
+      lval** cell; /* pointer to a list of LVALS, either small or buf */
+      lcells* buf; /* heap cells, NULL while the list fits in small */
+      lval* small[LVAL_SMALL];
+    };
+  };
 };
 
 
@@ -65,6 +952,53 @@ lval* lval_num(long x) {
   return v;
 }
 
+/* Create a floating point LVAL */
+lval* lval_dbl(double x) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_DBL;
+  v->dbl = x;
+  return v;
+}
+
+lval* lval_vec(lvec* x) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_VEC;
+  v->vec = x;
+  return v;
+}
+
+lval* lval_mat(lmat* m) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_MAT;
+  v->mat = m;
+  return v;
+}
+
+lval* lval_fut(lfut* f) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_FUT;
+  v->fut = f;
+  return v;
+}
+
+lval* lval_chan(lchan* c) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_CHAN;
+  v->chan = c;
+  return v;
+}
+
+/* Wrap up a bignum, going back to a plain number if it fits */
+lval* lval_big(lbig* b) {
+  long x;
+  if (lbig_to_long(b, &x)) { free(b); return lval_num(x); }
+  
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_BIG;
+  v->big = b;
+  return v;
+}
+
 /* Create an LVAL error, malloc, assign variables and error, return */
 lval* lval_err(char* fmt, ...) {
   lval* v = malloc( sizeof(lval));
@@ -89,15 +1023,21 @@ lval* lval_err(char* fmt, ...) {
   return v;
 }
 
-/* A pointer to a symbol */
-lval* lval_sym(char* s){
+/* A pointer to a symbol of the first n chars of s */
+lval* lval_sym_len(const char* s, int n){
 	lval* v = malloc(sizeof(lval));
 	v->type = LVAL_SYM;
-	v->sym = malloc(strlen(s) +1);
-	strcpy(v->sym, s);
+	v->sym = malloc(n +1);
+	memcpy(v->sym, s, n);
+	v->sym[n] = '\0';
 	return v;
 }
 
+/* A pointer to a symbol */
+lval* lval_sym(char* s){
+	return lval_sym_len(s, strlen(s));
+}
+
 /* A pointer to an lval function */
 lval* lval_fun(lbuiltin func) {
   lval* v = malloc(sizeof(lval));
@@ -111,18 +1051,159 @@ lval* lval_sexpr(void){
 	lval* v = malloc(sizeof(lval));
 	v->type = LVAL_SEXPR;
 	v->count = 0;
-	v->cell = NULL;
+	v->cap = LVAL_SMALL;
+	v->off = 0;
+	v->cell = v->small;
+	v->buf = NULL;
 	return v;
 }
 
-/* A pointer to a new empty Qexpr for data reads */
-lval* lval_qexpr(void) {
+/* A pointer to a Pair list holding a reference to the chain c */
+lval* lval_pair(lcons* c, int count) {
 	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_QEXPR;
-	v->count = 0;
-	v->cell = NULL;
+	v->type = LVAL_PAIR;
+	v->count = count;
+	v->pair = c;
 	return v;
-	
+}
+
+/* A pointer to a Rope list holding a reference to the tree t */
+lval* lval_rope(lrope* t) {
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_ROPE;
+	v->count = t ? t->count : 0;
+	v->rope = t;
+	return v;
+}
+
+/* A pointer to a new empty Qexpr for data reads */
+lval* lval_qexpr(void) {
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_QEXPR;
+	v->count = 0;
+	v->cap = LVAL_SMALL;
+	v->off = 0;
+	v->cell = v->small;
+	v->buf = NULL;
+	return v;
+	
+}
+
+lcells* lcells_new(int cap) {
+	lcells* b = malloc(sizeof(lcells) + sizeof(lval*) * cap);
+	b->refs = 1;
+	b->lo = -1;
+	b->hi = 0;
+	return b;
+}
+
+lval** lval_base(lval* v) {
+	return v->buf ? v->buf->slot : v->small;
+}
+
+int lval_shared(lval* v) {
+	return v->buf && LREF_GET(v->buf->refs) > 1;
+}
+
+void lval_del(lval* v);
+lval* lval_copy(lval* v);
+lfut* lfut_retain(lfut* f);
+void lfut_release(lfut* f);
+lchan* lchan_retain(lchan* c);
+void lchan_release(lchan* c);
+void lrope_release(lrope* t);
+
+/* Cons cells come from blocks of LCONS_BLOCK kept on a free list. */
+/* Each thread has its own list, so taking a cell needs no locking */
+#define LCONS_BLOCK 1024
+
+__thread lcons* lcons_pool = NULL;
+
+lcons* lcons_new(lval* car, lcons* cdr) {
+	if (!lcons_pool) {
+		LFUEL_BURN(LCONS_BLOCK);
+		lcons* block = malloc(sizeof(lcons) * LCONS_BLOCK);
+		for (int i = 0; i < LCONS_BLOCK; i++) {
+			block[i].cdr = i+1 < LCONS_BLOCK ? &block[i+1] : NULL;
+		}
+		lcons_pool = block;
+	}
+	
+	lcons* c = lcons_pool;
+	lcons_pool = c->cdr;
+	c->refs = 1;
+	c->car = car;
+	c->cdr = cdr;
+	return c;
+}
+
+/* Drop a hold on a chain, returning cells nobody holds to the pool. */
+/* Iterative so that long lists don't recurse once per cell */
+void lcons_release(lcons* c) {
+	while (c && LREF_DEC(c->refs) == 0) {
+		lcons* next = c->cdr;
+		lval_del(c->car);
+		c->cdr = lcons_pool;
+		lcons_pool = c;
+		c = next;
+	}
+}
+
+/* Once v is the only list left on its cells, delete any the block */
+/* still holds outside v's view from when it was shared */
+void lval_trim(lval* v) {
+	lcells* b = v->buf;
+	if (b->lo < 0) { return; }
+	
+	for (lval** c = b->slot + b->lo; c < v->cell; c++) { lval_del(*c); }
+	for (lval** c = v->cell + v->count; c < b->slot + b->hi; c++) {
+		lval_del(*c);
+	}
+	b->lo = -1;
+}
+
+/* Drop v's hold on its heap cells, the last list out deletes them */
+void lval_release(lval* v) {
+	if (LREF_DEC(v->buf->refs) > 0) { return; }
+	
+	lval_trim(v);
+	for (int i = 0; i < v->count; i++) {
+		lval_del(v->cell[i]);
+	}
+	free(v->buf);
+}
+
+/* Make sure no other list can see v's cells before they're changed */
+void lval_own(lval* v) {
+	if (!v->buf) { return; }
+	if (LREF_GET(v->buf->refs) == 1) { lval_trim(v); return; }
+	
+	/* Leave the shared cells as they are and copy ours out of them */
+	lcells* old = v->buf;
+	lval** cell = v->cell;
+	if (v->count <= LVAL_SMALL) {
+		v->buf = NULL;
+		v->cap = LVAL_SMALL;
+	} else {
+		v->buf = lcells_new(v->count);
+		v->cap = v->count;
+	}
+	v->off = 0;
+	v->cell = lval_base(v);
+	for (int i = 0; i < v->count; i++) {
+		v->cell[i] = lval_copy(cell[i]);
+	}
+	
+	/* Another thread may have let go of the old cells meanwhile */
+	if (LREF_DEC(old->refs) == 0) {
+		for (int i = old->lo; i < old->hi; i++) { lval_del(old->slot[i]); }
+		free(old);
+	}
+}
+
+/* Free the cell array once its items have been moved to another list */
+void lval_free_cells(lval* v) {
+	if (v->buf) { free(v->buf); }
 }
 
 void lval_del(lval* v){
@@ -130,19 +1211,27 @@ void lval_del(lval* v){
 	switch(v->type){
 		/* Do nothing special for number type */
 		case LVAL_NUM: break;
+		case LVAL_DBL: break;
 		case LVAL_FUN: break;
+		case LVAL_BIG: free(v->big); break;
+		case LVAL_VEC: free(v->vec); break;
+		case LVAL_MAT: lmat_del(v->mat); break;
+		case LVAL_FUT: lfut_release(v->fut); break;
+		case LVAL_CHAN: lchan_release(v->chan); break;
 		/* For Err or Symbol, free the string data */
 		case LVAL_ERR: free(v->err); break;
 		case LVAL_SYM: free(v->sym); break;
+		case LVAL_PAIR: lcons_release(v->pair); break;
+		case LVAL_ROPE: lrope_release(v->rope); break;
 		
 		/* If Sexpr or Qexpr then delete all elements inside */
 		/* Also free memory allocated to contain the pointers */
 		case LVAL_QEXPR:		
 		case LVAL_SEXPR:
+			if (v->buf) { lval_release(v); break; }
 			for(int i = 0; i < v->count; i++) {
 				lval_del(v->cell[i]);
 			}
-			free(v->cell);
 		break;
 	}
 	
@@ -160,6 +1249,17 @@ lval* lval_copy( lval* v ) {
     /* Copy functions and numbers directly */
     case LVAL_FUN: x->fun = v->fun; break;
     case LVAL_NUM: x->num = v->num; break;
+    case LVAL_DBL: x->dbl = v->dbl; break;
+    case LVAL_BIG: x->big = lbig_copy(v->big); break;
+    case LVAL_VEC:
+      x->vec = lvec_new(v->vec->dbl, v->vec->len);
+      memcpy(x->vec->e, v->vec->e, sizeof(lnum) * v->vec->len);
+    break;
+    
+    /* Matrices are never changed in place, so copies share the block */
+    case LVAL_MAT: x->mat = lmat_view(v->mat); break;
+    case LVAL_FUT: x->fut = lfut_retain(v->fut); break;
+    case LVAL_CHAN: x->chan = lchan_retain(v->chan); break;
     
     /* Copy Strings using malloc and strcpy */
     case LVAL_ERR:
@@ -170,11 +1270,41 @@ lval* lval_copy( lval* v ) {
       x->sym = malloc( strlen(v->sym) + 1);
       strcpy( x->sym, v->sym); break;
     
-    /* Copy List by copying each sub-expression */
+    /* Pairs just take another reference to the same chain */
+    case LVAL_PAIR:
+      x->count = v->count;
+      x->pair = v->pair;
+      if (x->pair) { LREF_INC(x->pair->refs); }
+    break;
+    
+    /* Ropes likewise */
+    case LVAL_ROPE:
+      x->count = v->count;
+      x->rope = v->rope;
+      if (x->rope) { LREF_INC(x->rope->refs); }
+    break;
+    
+    /* Lists on the heap share their cells until one side changes them */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
       x->count = v->count;
-      x->cell = malloc( sizeof(lval*) * x->count);
+      x->cap = v->cap;
+      x->off = v->off;
+      x->buf = v->buf;
+      if (v->buf) {
+        /* Several threads may copy an unshared list from lenv at once, */
+        /* but they all store the same range */
+        if (__atomic_load_n(&v->buf->lo, __ATOMIC_RELAXED) < 0) {
+          __atomic_store_n(&v->buf->hi, v->off + v->count, __ATOMIC_RELAXED);
+          __atomic_store_n(&v->buf->lo, v->off, __ATOMIC_RELAXED);
+        }
+        LREF_INC(v->buf->refs);
+        x->cell = v->cell;
+        break;
+      }
+      
+      /* Short lists are copied by copying each sub-expression */
+      x->cell = x->small + x->off;
       for ( int i = 0; i < x->count; i++) {
         x->cell[i] = lval_copy(v->cell[i]);
       }
@@ -186,36 +1316,112 @@ lval* lval_copy( lval* v ) {
 
 
 
+/* Make room for at least n cells, doubling so appends are amortized O(1) */
+void lval_reserve(lval* v, int n) {
+	lval_own(v);
+	if (n <= v->cap - v->off) { return; }
+	
+	lval** base = lval_base(v);
+	
+	/* Reuse the slots freed by popping the head once they make up half */
+	/* the array, so a list used as a queue doesn't grow without bound */
+	if (n <= v->cap && v->off >= v->cap/2) {
+		memmove(base, v->cell, sizeof(lval*) * v->count);
+		v->cell = base;
+		v->off = 0;
+		return;
+	}
+	
+	int cap = v->cap;
+	do { cap *= 2; } while (cap < n);
+	LFUEL_BURN(cap - v->cap);
+	
+	if (v->buf && v->off == 0) {
+		v->buf = realloc(v->buf, sizeof(lcells) + sizeof(lval*) * cap);
+	} else {
+		/* Spilling from the inline cells, or skipping the popped head */
+		lcells* buf = lcells_new(cap);
+		memcpy(buf->slot, v->cell, sizeof(lval*) * v->count);
+		lval_free_cells(v);
+		v->buf = buf;
+	}
+	v->cell = v->buf->slot;
+	v->cap = cap;
+	v->off = 0;
+}
+
 lval* lval_add(lval* v, lval* x){
-	v->count++;
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-	v->cell[v->count-1] = x;
+	lval_reserve(v, v->count+1);
+	v->cell[v->count++] = x;
+	return v;
+}
+
+/* Append n cells in one go, growing the array at most once */
+lval* lval_add_many(lval* v, lval** xs, int n) {
+	lval_reserve(v, v->count+n);
+	memcpy(&v->cell[v->count], xs, sizeof(lval*) * n);
+	v->count += n;
 	return v;
 }
 
 lval* lval_join(lval* x, lval* y) {  
-  for ( int i = 0; i < y->count; i++) {
-    x =lval_add(x, y->cell[i]);
-  }
-  free(y->cell);
+  lval_own(y);
+  x = lval_add_many(x, y->cell, y->count);
+  lval_free_cells(y);
   free(y);  
   return x;
 }
 
 
 lval* lval_pop(lval* v, int i) {
+	/* A shared list can drop either end without copying the rest, */
+	/* which keeps head and tail cheap on lists taken from lenv */
+	if (lval_shared(v) && (i == 0 || i == v->count-1)) {
+		lval* x = lval_copy(v->cell[i]);
+		if (i == 0) {
+			v->cell++;
+			v->off++;
+		}
+		v->count--;
+		return x;
+	}
+	lval_own(v);
+	
 	/* Find the item at "i" */
 	lval* x = v->cell[i];
 	
-	/* Shift memory after the item at "i" over the top */
-	memmove(&v->cell[i], &v->cell[i+1],
-				sizeof(lval*) * (v->count-i-1));
+	/* Close the gap from whichever side has fewer items to move. */
+	/* Popping the head just steps cell forward, which is O(1) */
+	if (i < v->count/2) {
+		memmove(&v->cell[1], &v->cell[0], sizeof(lval*) * i);
+		v->cell++;
+		v->off++;
+	} else {
+		memmove(&v->cell[i], &v->cell[i+1],
+					sizeof(lval*) * (v->count-i-1));
+	}
 				
 	/* Decrease the count of items in the list */
 	v->count--;
 	
-	/* Reallocate the memory used */
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+	/* Only give memory back once the list is a quarter full, so that */
+	/* alternating add and pop can't thrash realloc */
+	if (v->buf && v->count <= v->cap/4) {
+		if (v->count <= LVAL_SMALL) {
+			/* Small enough to move back inside the lval */
+			memcpy(v->small, v->cell, sizeof(lval*) * v->count);
+			lval_free_cells(v);
+			v->buf = NULL;
+			v->cell = v->small;
+			v->cap = LVAL_SMALL;
+		} else {
+			memmove(v->buf->slot, v->cell, sizeof(lval*) * v->count);
+			v->cap /= 2;
+			v->buf = realloc(v->buf, sizeof(lcells) + sizeof(lval*) * v->cap);
+			v->cell = v->buf->slot;
+		}
+		v->off = 0;
+	}
 	return x;
 }
 
@@ -226,9 +1432,240 @@ lval* lval_take(lval* v, int i) {
 	return x;
 }
 
+/* Turn a Qexpr into a Pair list, moving its items into cons cells */
+lval* lval_to_pair(lval* v) {
+	int count = v->count;
+	lcons* c = NULL;
+	while (v->count) {
+		c = lcons_new(lval_pop(v, v->count-1), c);
+	}
+	lval_del(v);
+	return lval_pair(c, count);
+}
+
+/* Turn a Pair list into a Qexpr. Cells no other list holds are moved */
+/* over, the first shared cell and everything after it is copied */
+lval* lval_from_pair(lval* v) {
+	lval* x = lval_qexpr();
+	lval_reserve(x, v->count);
+	
+	lcons* c = v->pair;
+	while (c && LREF_GET(c->refs) == 1) {
+		lcons* next = c->cdr;
+		lval_add(x, c->car);
+		c->cdr = lcons_pool;
+		lcons_pool = c;
+		c = next;
+	}
+	for (lcons* d = c; d; d = d->cdr) {
+		lval_add(x, lval_copy(d->car));
+	}
+	
+	/* The hold on c passed down to us from the last cell moved */
+	lcons_release(c);
+	free(v);
+	return x;
+}
+
+/* Chain the items of Qexpr or Pair x in front of rest, consuming x */
+/* and taking over the caller's hold on rest */
+lcons* lcons_append(lval* x, lcons* rest) {
+	if (x->type == LVAL_QEXPR) {
+		while (x->count) {
+			rest = lcons_new(lval_pop(x, x->count-1), rest);
+		}
+		lval_del(x);
+		return rest;
+	}
+	
+	/* A Pair's cells are copied, its tail can't be pointed at rest */
+	lcons* head = rest;
+	lcons** link = &head;
+	for (lcons* c = x->pair; c; c = c->cdr) {
+		*link = lcons_new(lval_copy(c->car), rest);
+		link = &(*link)->cdr;
+	}
+	lval_del(x);
+	return head;
+}
+
+/* Ropes */
+
+/* A leaf over the n items at item, taking them over */
+lrope* lrope_leaf(lval** item, int n) {
+	LFUEL_BURN(n);
+	lrope* t = malloc(sizeof(lrope) + sizeof(lval*) * n);
+	t->refs = 1;
+	t->count = n;
+	t->height = 0;
+	t->l = t->r = NULL;
+	memcpy(t->item, item, sizeof(lval*) * n);
+	return t;
+}
+
+/* A branch over l and r, taking over the caller's holds on both */
+lrope* lrope_branch(lrope* l, lrope* r) {
+	LFUEL_BURN(1);
+	lrope* t = malloc(sizeof(lrope));
+	t->refs = 1;
+	t->count = l->count + r->count;
+	t->height = (l->height > r->height ? l->height : r->height) + 1;
+	t->l = l;
+	t->r = r;
+	return t;
+}
+
+lrope* lrope_retain(lrope* t) {
+	if (t) { LREF_INC(t->refs); }
+	return t;
+}
+
+/* Drop a hold on t. Trees are balanced, so this recurses no deeper */
+/* than about log2 of the count */
+void lrope_release(lrope* t) {
+	if (!t || LREF_DEC(t->refs) > 0) { return; }
+	
+	if (t->height) {
+		lrope_release(t->l);
+		lrope_release(t->r);
+	} else {
+		for (int i = 0; i < t->count; i++) { lval_del(t->item[i]); }
+	}
+	free(t);
+}
+
+/* A branch over l and r, rotated once or twice when one side is two */
+/* taller, as it can be after something is joined onto it */
+lrope* lrope_balance(lrope* l, lrope* r) {
+	lrope* t;
+	if (l->height > r->height + 1) {
+		lrope* a = lrope_retain(l->l);
+		lrope* b = l->r;
+		if (a->height >= b->height) {
+			t = lrope_branch(a, lrope_branch(lrope_retain(b), r));
+		} else {
+			t = lrope_branch(lrope_branch(a, lrope_retain(b->l)),
+				lrope_branch(lrope_retain(b->r), r));
+		}
+		lrope_release(l);
+		return t;
+	}
+	if (r->height > l->height + 1) {
+		lrope* a = r->l;
+		lrope* b = lrope_retain(r->r);
+		if (b->height >= a->height) {
+			t = lrope_branch(lrope_branch(l, lrope_retain(a)), b);
+		} else {
+			t = lrope_branch(lrope_branch(l, lrope_retain(a->l)),
+				lrope_branch(lrope_retain(a->r), b));
+		}
+		lrope_release(r);
+		return t;
+	}
+	return lrope_branch(l, r);
+}
+
+/* The items of a followed by those of b, taking over the caller's */
+/* holds on both. The shorter tree is joined on down the side of the */
+/* taller one, so only the O(log n) nodes along that side are new */
+lrope* lrope_join(lrope* a, lrope* b) {
+	if (!a) { return b; }
+	if (!b) { return a; }
+	
+	if (a->height > b->height + 1) {
+		lrope* l = lrope_retain(a->l);
+		lrope* r = lrope_join(lrope_retain(a->r), b);
+		lrope_release(a);
+		return lrope_balance(l, r);
+	}
+	if (b->height > a->height + 1) {
+		lrope* l = lrope_join(a, lrope_retain(b->l));
+		lrope* r = lrope_retain(b->r);
+		lrope_release(b);
+		return lrope_balance(l, r);
+	}
+	
+	/* Leaves that fit in one are merged, so joining a few items at a */
+	/* time doesn't leave a tree of tiny leaves */
+	if (!a->height && !b->height && a->count + b->count <= LROPE_LEAF) {
+		lval* item[LROPE_LEAF];
+		int n = 0;
+		for (int i = 0; i < a->count; i++) { item[n++] = lval_copy(a->item[i]); }
+		for (int i = 0; i < b->count; i++) { item[n++] = lval_copy(b->item[i]); }
+		lrope_release(a);
+		lrope_release(b);
+		return lrope_leaf(item, n);
+	}
+	return lrope_branch(a, b);
+}
+
+/* A hold on items lo to hi of t, NULL if there are none. Nodes wholly */
+/* inside are shared, and at most the two leaves at the ends copied */
+lrope* lrope_slice(lrope* t, int lo, int hi) {
+	if (lo >= hi) { return NULL; }
+	if (lo == 0 && hi == t->count) { return lrope_retain(t); }
+	
+	if (!t->height) {
+		lval* item[LROPE_LEAF];
+		for (int i = lo; i < hi; i++) { item[i-lo] = lval_copy(t->item[i]); }
+		return lrope_leaf(item, hi - lo);
+	}
+	
+	int n = t->l->count;
+	if (hi <= n) { return lrope_slice(t->l, lo, hi); }
+	if (lo >= n) { return lrope_slice(t->r, lo - n, hi - n); }
+	return lrope_join(lrope_slice(t->l, lo, n), lrope_slice(t->r, 0, hi - n));
+}
+
+/* A balanced tree over the n items at item, taking them over. Halves */
+/* differ by at most one item, so their heights by at most one */
+lrope* lrope_build(lval** item, int n) {
+	if (n <= LROPE_LEAF) { return lrope_leaf(item, n); }
+	int h = n / 2;
+	return lrope_branch(lrope_build(item, h), lrope_build(item + h, n - h));
+}
+
+/* Copy the items under t onto the end of x */
+void lrope_add_to(lval* x, lrope* t) {
+	if (!t) { return; }
+	if (t->height) {
+		lrope_add_to(x, t->l);
+		lrope_add_to(x, t->r);
+		return;
+	}
+	for (int i = 0; i < t->count; i++) { lval_add(x, lval_copy(t->item[i])); }
+}
+
+/* Turn a Qexpr into a Rope, moving its items into the leaves */
+lval* lval_to_rope(lval* v) {
+	lval_own(v);
+	lrope* t = v->count ? lrope_build(v->cell, v->count) : NULL;
+	v->count = 0;
+	lval_del(v);
+	return lval_rope(t);
+}
+
+/* Turn a Rope into a Qexpr of copies of its items */
+lval* lval_from_rope(lval* v) {
+	lval* x = lval_qexpr();
+	lval_reserve(x, v->count);
+	lrope_add_to(x, v->rope);
+	lval_del(v);
+	return x;
+}
+
+/* The Qexpr a Pair or Rope stands for, other values passing through */
+lval* lval_flat(lval* v) {
+	if (v->type == LVAL_PAIR) { return lval_from_pair(v); }
+	if (v->type == LVAL_ROPE) { return lval_from_rope(v); }
+	return v;
+}
+
 void lval_print(lval *v); /* preprocess */
+void lval_fut_print(lfut* f);
+void lval_chan_print(lchan* c);
 void lval_expr_print(lval* v, char open, char close){
-	putchar(open);
+	fputc(open, LOUT);
 	for(int i = 0; i< v->count; i++){
 		
 		/* Print Value contained within */
@@ -236,89 +1673,376 @@ void lval_expr_print(lval* v, char open, char close){
 		
 		/* Don't print trailing space if last element. */
 		if(i != (v->count-1)){
-			putchar(' ');
+			fputc(' ', LOUT);
 		}
 	}
-	putchar(close);
+	fputc(close, LOUT);
+}
+
+/* Shortest round-trip digits, by Giulietti's Schubfach. A double is */
+/* c * 2^q, and everything within half a unit of it reads back as it. */
+/* Scaling c and both ends of that interval by a 128-bit power of ten */
+/* puts the interval between two decimal digit positions, where the */
+/* shortest decimal inside it is read off with a few comparisons */
+
+/* floor(10^k * 2^-e) + 1 for k from LDBL_K_MIN to LDBL_K_MAX, high */
+/* word first, e picked so each is between 2^127 and 2^128. Filled */
+/* in exactly once by ldbl_init */
+#define LDBL_K_MIN -292
+#define LDBL_K_MAX 326
+uint64_t ldbl_pow10[LDBL_K_MAX - LDBL_K_MIN + 1][2];
+
+/* floor(log2(10^e)), floor(log10(2^e)) and floor(log10(3/4 * 2^e)) */
+int ldbl_log2_pow10(int e) { return (e * 1741647) >> 19; }
+int ldbl_log10_pow2(int e) { return (e * 1262611) >> 22; }
+int ldbl_log10_pow2_34(int e) { return (e * 1262611 - 524031) >> 22; }
+
+/* Top 128 bits of the n-word little-endian number a, plus one */
+void ldbl_top(uint32_t* a, int n, uint64_t* g) {
+  while (a[n-1] == 0) { n--; }
+  int t = (n-1) * 32 + (32 - __builtin_clz(a[n-1])) - 128;
+  uint32_t w[4];
+  for (int i = 0; i < 4; i++) {
+    int b = t + i * 32, j = b / 32, r = b % 32;
+    uint64_t x = a[j] | (j+1 < n ? (uint64_t)a[j+1] << 32 : 0);
+    w[i] = (uint32_t)(x >> r);
+  }
+  g[0] = (uint64_t)w[3] << 32 | w[2];
+  g[1] = ((uint64_t)w[1] << 32 | w[0]) + 1;
+}
+
+/* The table from exact powers. 10^k * 2^256 for k >= 0, and */
+/* floor(2^1400 / 10^-k) below that, have plenty of bits to take */
+/* the top 128 from */
+void ldbl_init(void) {
+  uint32_t a[48];
+  memset(a, 0, sizeof(a));
+  a[8] = 1;
+  for (int k = 0; k <= LDBL_K_MAX; k++) {
+    ldbl_top(a, 48, ldbl_pow10[k - LDBL_K_MIN]);
+    uint64_t carry = 0;
+    for (int i = 0; i < 48; i++) {
+      uint64_t x = (uint64_t)a[i] * 10 + carry;
+      a[i] = (uint32_t)x;
+      carry = x >> 32;
+    }
+  }
+  memset(a, 0, sizeof(a));
+  a[43] = 1u << 24;
+  for (int k = -1; k >= LDBL_K_MIN; k--) {
+    uint64_t rem = 0;
+    for (int i = 47; i >= 0; i--) {
+      uint64_t x = rem << 32 | a[i];
+      a[i] = (uint32_t)(x / 10);
+      rem = x % 10;
+    }
+    ldbl_top(a, 48, ldbl_pow10[k - LDBL_K_MIN]);
+  }
+}
+
+/* The top 64 bits of g * cp / 2^128, with a 1 or'd in if anything */
+/* was cut off, which keeps comparisons against it exact */
+uint64_t ldbl_round_to_odd(uint64_t* g, uint64_t cp) {
+  unsigned __int128 x = (unsigned __int128)g[1] * cp;
+  unsigned __int128 y = (unsigned __int128)g[0] * cp + (uint64_t)(x >> 64);
+  return (uint64_t)(y >> 64) | ((uint64_t)y > 1);
+}
+
+/* Shortest digits of positive finite x as *m * 10^*k */
+void ldbl_shortest(double x, uint64_t* m, int* k) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  uint64_t f = bits & ((1ull << 52) - 1);
+  int be = (int)(bits >> 52);
+  uint64_t c = be ? f | 1ull << 52 : f;
+  int q = be ? be - 1075 : -1074;
+  
+  /* Ends of the rounding interval, four times scaled, inclusive */
+  /* when c is even as ties read back to even */
+  int even = (c & 1) == 0;
+  int closer = f == 0 && be > 1; /* the gap below is half the size */
+  uint64_t cbl = 4*c - 2 + closer, cb = 4*c, cbr = 4*c + 2;
+  int e10 = closer ? ldbl_log10_pow2_34(q) : ldbl_log10_pow2(q);
+  int h = q + ldbl_log2_pow10(-e10) + 1;
+  uint64_t* g = ldbl_pow10[-e10 - LDBL_K_MIN];
+  uint64_t vbl = ldbl_round_to_odd(g, cbl << h);
+  uint64_t vb = ldbl_round_to_odd(g, cb << h);
+  uint64_t vbr = ldbl_round_to_odd(g, cbr << h);
+  uint64_t lower = vbl + !even, upper = vbr - !even;
+  
+  /* One digit fewer if a multiple of ten is inside, else whichever */
+  /* neighbour is inside, else the nearest with ties to even */
+  uint64_t s = vb / 4;
+  if (s >= 10) {
+    uint64_t sp = s / 10;
+    int up = lower <= 40*sp, wp = 40*sp + 40 <= upper;
+    if (up != wp) { *m = sp + wp; *k = e10 + 1; return; }
+  }
+  int u = lower <= 4*s, w = 4*s + 4 <= upper;
+  if (u != w) { *m = s + w; *k = e10; return; }
+  uint64_t mid = 4*s + 2;
+  *m = s + (vb > mid || (vb == mid && (s & 1)));
+  *k = e10;
+}
+
+/* Write finite non-zero x to buf as printf's %.<n>g would, with n the */
+/* shortest digit count that reads back as x. Returns the length */
+int ldbl_format(char* buf, double x) {
+  char* p = buf;
+  if (x < 0) { *p++ = '-'; x = -x; }
+  uint64_t m;
+  int k;
+  ldbl_shortest(x, &m, &k);
+  while (m % 10 == 0) { m /= 10; k++; }
+  
+  char d[20];
+  int n = 0;
+  for (uint64_t t = m; t || !n; t /= 10) { n++; }
+  for (int i = n-1; i >= 0; i--) { d[i] = '0' + m % 10; m /= 10; }
+  
+  /* %g's choice: fixed unless the exponent is below -4 or too big */
+  /* for the digits, and no trailing zeros either way */
+  int e = k + n - 1;
+  if (e < -4 || e >= n) {
+    *p++ = d[0];
+    if (n > 1) { *p++ = '.'; memcpy(p, d+1, n-1); p += n-1; }
+    *p++ = 'e';
+    *p++ = e < 0 ? '-' : '+';
+    if (e < 0) { e = -e; }
+    if (e >= 100) { *p++ = '0' + e / 100; }
+    *p++ = '0' + e / 10 % 10;
+    *p++ = '0' + e % 10;
+  } else if (e >= 0) {
+    memcpy(p, d, e+1); p += e+1;
+    if (n > e+1) { *p++ = '.'; memcpy(p, d+e+1, n-e-1); p += n-e-1; }
+  } else {
+    *p++ = '0'; *p++ = '.';
+    for (int i = -1; i > e; i--) { *p++ = '0'; }
+    memcpy(p, d, n); p += n;
+  }
+  *p = '\0';
+  return p - buf;
+}
+
+/* Print the shortest digits that read back as the same double. Whole */
+/* numbers print straight from a long, and anything that would look */
+/* like an integer gets a ".0" so floats stay recognisable */
+void lval_dbl_print(double x) {
+  char buf[32];
+  if (!isfinite(x)) {
+    snprintf(buf, sizeof(buf), "%g", x);
+  } else if (x > -1e15 && x < 1e15 && x == (long)x) {
+    snprintf(buf, sizeof(buf), "%li", (long)x);
+    if (x == 0 && signbit(x)) { buf[0] = '-'; buf[1] = '0'; buf[2] = '\0'; }
+  } else {
+    ldbl_format(buf, x);
+  }
+  fputs(buf, LOUT);
+  if (!strpbrk(buf, ".en")) { fputs(".0", LOUT); }
+}
+
+void lval_vec_print(lvec* v) {
+  fputc('[', LOUT);
+  for (int i = 0; i < v->len; i++) {
+    if (v->dbl) { lval_dbl_print(v->e[i].d); }
+    else { fprintf(LOUT, "%li", (long)v->e[i].i); }
+    if (i != v->len-1) { fputc(' ', LOUT); }
+  }
+  fputc(']', LOUT);
+}
+
+void lval_mat_print(lmat* m) {
+  fputc('[', LOUT);
+  for (int i = 0; i < m->rows; i++) {
+    fputc('[', LOUT);
+    for (int j = 0; j < m->cols; j++) {
+      lval_dbl_print(m->at[i*m->rs + j*m->cs]);
+      if (j != m->cols-1) { fputc(' ', LOUT); }
+    }
+    fputc(']', LOUT);
+    if (i != m->rows-1) { fputc(' ', LOUT); }
+  }
+  fputc(']', LOUT);
+}
+
+/* Pairs print the same as the Qexpr they stand for */
+void lval_pair_print(lval* v) {
+	fputc('{', LOUT);
+	for (lcons* c = v->pair; c; c = c->cdr) {
+		lval_print(c->car);
+		if (c->cdr) { fputc(' ', LOUT); }
+	}
+	fputc('}', LOUT);
+}
+
+/* Ropes too, walking the leaves in order */
+void lrope_print(lrope* t, int* first) {
+	if (!t) { return; }
+	if (t->height) {
+		lrope_print(t->l, first);
+		lrope_print(t->r, first);
+		return;
+	}
+	for (int i = 0; i < t->count; i++) {
+		if (!*first) { fputc(' ', LOUT); }
+		*first = 0;
+		lval_print(t->item[i]);
+	}
+}
+
+void lval_rope_print(lval* v) {
+	int first = 1;
+	fputc('{', LOUT);
+	lrope_print(v->rope, &first);
+	fputc('}', LOUT);
 }
 
 void lval_print(lval* v) {
   switch (v->type) {
     /* print if number, error, symbol or list expression */
-	case LVAL_FUN:   printf("<function>"); break;
-    case LVAL_NUM:   printf("%li", v->num); break;
-    case LVAL_ERR:   printf("Error: %s", v->err); break;
-    case LVAL_SYM:   printf("%s", v->sym); break;
-    case LVAL_SEXPR: lval_print_expr(v, '(', ')'); break;
-    case LVAL_QEXPR: lval_print_expr(v, '{', '}'); break;
+	case LVAL_FUN:   fprintf(LOUT, "<function>"); break;
+    case LVAL_NUM:   fprintf(LOUT, "%li", v->num); break;
+    case LVAL_BIG:   lbig_print(v->big); break;
+    case LVAL_DBL:   lval_dbl_print(v->dbl); break;
+    case LVAL_VEC:   lval_vec_print(v->vec); break;
+    case LVAL_MAT:   lval_mat_print(v->mat); break;
+    case LVAL_FUT:   lval_fut_print(v->fut); break;
+    case LVAL_CHAN:  lval_chan_print(v->chan); break;
+    case LVAL_ERR:   fprintf(LOUT, "Error: %s", v->err); break;
+    case LVAL_SYM:   fprintf(LOUT, "%s", v->sym); break;
+    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
+    case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+    case LVAL_PAIR:  lval_pair_print(v); break;
+    case LVAL_ROPE:  lval_rope_print(v); break;
   }
 }
 
 
 /* Print an "lval" followed by a new line */
-void lval_println(lval* v) { lval_print(v); putchar('\n'); }
+void lval_println(lval* v) { lval_print(v); fputc('\n', LOUT); }
 
 char* ltype_name(int t) {
   switch(t) {
     case LVAL_FUN: return "Function";
     case LVAL_NUM: return "Number";
+    case LVAL_BIG: return "Number";
+    case LVAL_DBL: return "Number";
+    case LVAL_VEC: return "Vector";
+    case LVAL_MAT: return "Matrix";
+    case LVAL_FUT: return "Future";
+    case LVAL_CHAN: return "Channel";
     case LVAL_ERR: return "Error";
     case LVAL_SYM: return "Symbol";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_PAIR: return "Pair";
+    case LVAL_ROPE: return "Rope";
     default: return "Unknown";
   }
 }
 
 /* Lisp Environment */
 
+/* Futures read the environment while def may be changing it, so */
+/* every access takes lock. Running futures hold a reference */
 struct lenv {
+  int refs;
   int count;
   char** syms;
   lval** vals;
+  pthread_rwlock_t lock;
 };
 
 lenv* lenv_new(void) {
 
   /* Initialize struct */
   lenv* e = malloc(sizeof(lenv));
+  e->refs = 1;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  pthread_rwlock_init(&e->lock, NULL);
   return e;
   
 }
 
-void lenv_del(lenv* e) {
+/* Drop every binding. Values such as futures can refer back to */
+/* the environment, so this breaks those cycles */
+void lenv_clear(lenv* e) {
+  
+  pthread_rwlock_wrlock(&e->lock);
+  int count = e->count;
+  char** syms = e->syms;
+  lval** vals = e->vals;
+  e->count = 0;
+  e->syms = NULL;
+  e->vals = NULL;
+  pthread_rwlock_unlock(&e->lock);
   
   /* Iterate over all items in environment deleting them */
-  for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
+  for (int i = 0; i < count; i++) {
+    free(syms[i]);
+    lval_del(vals[i]);
   }
   
   /* Free allocated memory for lists */
-  free(e->syms);
-  free(e->vals);
+  free(syms);
+  free(vals);
+}
+
+void lenv_del(lenv* e) {
+  lenv_clear(e);
+  pthread_rwlock_destroy(&e->lock);
   free(e);
 }
 
+lenv* lenv_retain(lenv* e) {
+  LREF_INC(e->refs);
+  return e;
+}
+
+void lenv_release(lenv* e) {
+  if (LREF_DEC(e->refs) == 0) { lenv_del(e); }
+}
+
 lval* lenv_get(lenv* e, lval* k) {
   
+  pthread_rwlock_rdlock(&e->lock);
+  
   /* Iterate over all items in environment */
   for (int i = 0; i < e->count; i++) {
     /* Check if the stored string matches the symbol string */
     /* If it does, return a copy of the value */
     if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
+      lval* x = lval_copy(e->vals[i]);
+      pthread_rwlock_unlock(&e->lock);
+      return x;
     }
   }
+  pthread_rwlock_unlock(&e->lock);
+  
   /* If no symbol found return error */
   return lval_err("Unbound Symbol '%s'", k->sym);
 }
 
+/* The builtin sym is bound to, or NULL if it isn't a function */
+lbuiltin lenv_get_fun(lenv* e, char* sym) {
+  lbuiltin f = NULL;
+  pthread_rwlock_rdlock(&e->lock);
+  for (int i = 0; i < e->count; i++) {
+    if (strcmp(e->syms[i], sym) == 0) {
+      if (e->vals[i]->type == LVAL_FUN) { f = e->vals[i]->fun; }
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&e->lock);
+  return f;
+}
+
 void lenv_put(lenv* e, lval* k, lval* v) {
   
+  pthread_rwlock_wrlock(&e->lock);
+  
   /* Iterate over all items in environment */
   /* This is to see if variable already exists */
   for (int i = 0; i < e->count; i++) {
@@ -328,6 +2052,7 @@ void lenv_put(lenv* e, lval* k, lval* v) {
     if (strcmp(e->syms[i], k->sym) == 0) {
       lval_del(e->vals[i]);
       e->vals[i] = lval_copy(v);
+      pthread_rwlock_unlock(&e->lock);
       return;
     }
   }
@@ -341,322 +2066,3366 @@ void lenv_put(lenv* e, lval* k, lval* v) {
   e->vals[e->count-1] = lval_copy(v);
   e->syms[e->count-1] = malloc(strlen(k->sym)+1);
   strcpy(e->syms[e->count-1], k->sym);
+  
+  pthread_rwlock_unlock(&e->lock);
 }
 
-/* Builtins */
-
-#define LASSERT(args, cond, fmt, ...) \
-  if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
-
-#define LASSERT_TYPE(func, args, index, expect) \
-  LASSERT(args, args->cell[index]->type == expect, \
-    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+/* Thread Pool */
 
-#define LASSERT_NUM(func, args, num) \
-  LASSERT(args, args->count == num, \
-    "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
-    func, args->count, num)
+typedef struct ljob {
+  void (*run)(void* arg);
+  void* arg;
+  int* pending; /* counted down once the job has run, if not NULL */
+  long fuel, limit; /* lpool_run only, see lpool_run_fueled */
+} ljob;
 
-#define LASSERT_NOT_EMPTY(func, args, index) \
-  LASSERT(args, args->cell[index]->count != 0, \
-    "Function '%s' passed {} for argument %i.", func, index);
+/* Threads to use, counting the caller, set by --threads. 0 means */
+/* one per CPU */
+int lpool_threads = 0;
 
+/* Set while this thread is running a job. Jobs only read lenv */
+__thread int lpool_in_job = 0;
 
-lval* lval_eval(lenv* e, lval* v);
+/* Index of this thread's deque, or -1 for threads outside the pool */
+__thread int lpool_id = -1;
 
-lval* builtin_list(lenv* e, lval* a) {
-  a->type = LVAL_QEXPR;
-  return a;
-}
+/* Each thread has a Chase-Lev deque of jobs. The owner pushes and */
+/* pops at the bottom, idle threads steal from the top. Rings are */
+/* never freed once outgrown, as a thief may still be reading them */
+typedef struct lring {
+  long cap; /* a power of two */
+  struct lring* old;
+  ljob* slot[];
+} lring;
 
-lval* builtin_head(lval* a) {
-  LASSERT(a, a->count == 1,
-    "Function 'head' passed too many arguments.");
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-    "Function 'head' passed incorrect type.");
-  LASSERT(a, a->cell[0]->count != 0,
-    "Function 'head' passed {}.");
-	
-	lval* v = lval_take(a,0);
-	while (v->count > 1) { lval_del(lval_pop(v,1));}
-	return v;
-}
+typedef struct ldeque {
+  long top, bottom;
+  lring* ring;
+  char pad[64]; /* keep deques on separate cache lines */
+} ldeque;
 
-lval* builtin_tail(lval* a) {
-  LASSERT(a, a->count == 1,
-    "Function 'tail' passed too many arguments.");
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-    "Function 'tail' passed incorrect type.");
-  LASSERT(a, a->cell[0]->count != 0,
-    "Function 'tail' passed {}.");
+#define LJOB_EMPTY ((ljob*)0)
+#define LJOB_ABORT ((ljob*)1)
 
-  lval* v = lval_take(a, 0);  
-  lval_del(lval_pop(v, 0));
-  return v;
-}
-lval* builtin_tail(lenv* e, lval* a) {
-  LASSERT_NUM("tail", a, 1);
-  LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
-  LASSERT_NOT_EMPTY("tail", a, 0);
+struct {
+  ldeque* q;
+  int started;
+  /* Jobs nobody waits on, such as futures. Only idle threads take */
+  /* them, never one waiting in lpool_run, as they may block */
+  ljob** spawned;
+  int head, count, cap;
+  /* Bumped on every push. Idle threads sleep until it moves */
+  long epoch;
+  int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} lpool = { NULL, 0, NULL, 0, 0, 0, 0, 0,
+            PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
 
-  lval* v = lval_take(a, 0);  
-  lval_del(lval_pop(v, 0));
-  return v;
+lring* lring_new(long cap, lring* old) {
+  lring* r = malloc(sizeof(lring) + sizeof(ljob*) * cap);
+  r->cap = cap;
+  r->old = old;
+  return r;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
-  LASSERT_NUM("eval", a, 1);
-  LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+void ldeque_push(ldeque* d, ljob* j) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  lring* r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
   
-  lval* x = lval_take(a, 0);
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  if (b - t > r->cap - 1) {
+    lring* g = lring_new(r->cap * 2, r);
+    for (long i = t; i < b; i++) {
+      g->slot[i & (g->cap-1)] =
+        __atomic_load_n(&r->slot[i & (r->cap-1)], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&d->ring, g, __ATOMIC_RELEASE);
+    r = g;
+  }
+  
+  __atomic_store_n(&r->slot[b & (r->cap-1)], j, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELEASE);
 }
 
-lval* builtin_join(lenv* e, lval* a) {
+ljob* ldeque_take(ldeque* d) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  lring* r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+  long t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
   
-  for (int i = 0; i < a->count; i++) {
-    LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+  if (t > b) {
+    __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+    return LJOB_EMPTY;
   }
   
-  lval* x = lval_pop(a, 0);
+  ljob* j = __atomic_load_n(&r->slot[b & (r->cap-1)], __ATOMIC_RELAXED);
+  if (t == b) {
+    /* Last job, race any thief for it */
+    if (!__atomic_compare_exchange_n(&d->top, &t, t+1, 0,
+          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      j = LJOB_EMPTY;
+    }
+    __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+  }
+  return j;
+}
+
+ljob* ldeque_steal(ldeque* d) {
+  long t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+  if (t >= b) { return LJOB_EMPTY; }
+  
+  lring* r = __atomic_load_n(&d->ring, __ATOMIC_ACQUIRE);
+  ljob* j = __atomic_load_n(&r->slot[t & (r->cap-1)], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&d->top, &t, t+1, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return LJOB_ABORT;
+  }
+  return j;
+}
+
+int lpool_size(void) {
+  if (lpool_threads <= 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    lpool_threads = n > 0 ? n : 1;
+  }
+  return lpool_threads;
+}
+
+/* Run a job of lpool_run with the fuel its caller had left, and */
+/* leave in j->fuel what it used for the caller to be charged */
+void lpool_run_fueled(ljob* j) {
+  long fuel = lfuel, limit = lfuel_limit;
+  lfuel_fill(j->limit);
+  lfuel = j->fuel;
+  j->run(j->arg);
+  j->fuel -= lfuel;
+  lfuel = fuel;
+  lfuel_limit = limit;
+}
+
+void lpool_exec(ljob* j) {
+  int* pending = j->pending; /* j may be gone once it has run */
+  int in_job = lpool_in_job;
+  lpool_in_job = 1;
+  if (pending) { lpool_run_fueled(j); } else { j->run(j->arg); }
+  lpool_in_job = in_job;
+  if (pending) { __atomic_sub_fetch(pending, 1, __ATOMIC_RELEASE); }
+}
+
+/* Pop our own newest job, or else steal the oldest job of another */
+/* thread. Sets busy if a steal lost a race and is worth retrying */
+ljob* lpool_find(int* busy) {
+  ljob* j = ldeque_take(&lpool.q[lpool_id]);
+  if (j) { return j; }
+  
+  static __thread unsigned seed = 0;
+  if (!seed) { seed = 2654435761u * (lpool_id + 1); }
+  seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+  
+  int n = lpool_threads;
+  for (int k = 0, v = seed % n; k < n; k++, v = (v+1) % n) {
+    if (v == lpool_id) { continue; }
+    j = ldeque_steal(&lpool.q[v]);
+    if (j == LJOB_ABORT) { *busy = 1; continue; }
+    if (j) { return j; }
+  }
+  return NULL;
+}
+
+/* Tasks parked on file descriptors are woken by the event loop, */
+/* which idle threads run instead of sleeping. See Event Loop */
+int lio_claim(void);
+void lio_unclaim(void);
+void lio_poll(int timeout);
+void lio_poke(void);
+
+void* lpool_main(void* id) {
+  lpool_id = (int)(intptr_t)id;
+  while (1) {
+    long epoch = __atomic_load_n(&lpool.epoch, __ATOMIC_SEQ_CST);
+    int busy = 0;
+    ljob* j = lpool_find(&busy);
+    if (j) { lpool_exec(j); continue; }
+    if (busy) { continue; }
+    
+    /* Nothing to steal. Take a spawned job, or sleep unless */
+    /* something was pushed meanwhile */
+    pthread_mutex_lock(&lpool.lock);
+    if (lpool.count) {
+      j = lpool.spawned[lpool.head];
+      lpool.head = (lpool.head + 1) % lpool.cap;
+      lpool.count--;
+      pthread_mutex_unlock(&lpool.lock);
+      lpool_exec(j);
+      continue;
+    }
+    if (lio_claim()) {
+      pthread_mutex_unlock(&lpool.lock);
+      if (__atomic_load_n(&lpool.epoch, __ATOMIC_SEQ_CST) == epoch) {
+        lio_poll(-1);
+      }
+      lio_unclaim();
+      continue;
+    }
+    __atomic_add_fetch(&lpool.sleepers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&lpool.epoch, __ATOMIC_SEQ_CST) == epoch) {
+      pthread_cond_wait(&lpool.wake, &lpool.lock);
+    }
+    __atomic_sub_fetch(&lpool.sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lpool.lock);
+  }
+  return NULL;
+}
+
+/* The first thread to use the pool becomes its thread 0 */
+void lpool_start(void) {
+  pthread_mutex_lock(&lpool.lock);
+  if (!lpool.started) {
+    lpool.q = calloc(lpool_threads, sizeof(ldeque));
+    for (int i = 0; i < lpool_threads; i++) {
+      lpool.q[i].ring = lring_new(64, NULL);
+    }
+    lpool_id = 0;
+    for (int i = 1; i < lpool_threads; i++) {
+      pthread_t t;
+      pthread_create(&t, NULL, lpool_main, (void*)(intptr_t)i);
+      pthread_detach(t);
+    }
+    __atomic_store_n(&lpool.started, 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&lpool.lock);
+}
+
+void lpool_wake(void) {
+  __atomic_add_fetch(&lpool.epoch, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&lpool.sleepers, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&lpool.lock);
+    pthread_cond_broadcast(&lpool.wake);
+    pthread_mutex_unlock(&lpool.lock);
+  }
+  lio_poke();
+}
+
+/* Queue a job nobody waits for. With no other threads it waits */
+/* for lpool_take */
+void lpool_spawn(ljob* j) {
+  if (lpool_size() > 1 && !__atomic_load_n(&lpool.started, __ATOMIC_ACQUIRE)) {
+    lpool_start();
+  }
+  
+  pthread_mutex_lock(&lpool.lock);
+  if (lpool.count == lpool.cap) {
+    int cap = lpool.cap ? lpool.cap * 2 : 64;
+    ljob** q = malloc(sizeof(ljob*) * cap);
+    for (int i = 0; i < lpool.count; i++) {
+      q[i] = lpool.spawned[(lpool.head + i) % lpool.cap];
+    }
+    free(lpool.spawned);
+    lpool.spawned = q;
+    lpool.head = 0;
+    lpool.cap = cap;
+  }
+  lpool.spawned[(lpool.head + lpool.count++) % lpool.cap] = j;
+  pthread_mutex_unlock(&lpool.lock);
+  
+  lpool_wake();
+}
+
+/* Take the oldest spawned job, or NULL */
+ljob* lpool_take(void) {
+  ljob* j = NULL;
+  pthread_mutex_lock(&lpool.lock);
+  if (lpool.count) {
+    j = lpool.spawned[lpool.head];
+    lpool.head = (lpool.head + 1) % lpool.cap;
+    lpool.count--;
+  }
+  pthread_mutex_unlock(&lpool.lock);
+  return j;
+}
+
+int lpool_queued(void) {
+  pthread_mutex_lock(&lpool.lock);
+  int n = lpool.count;
+  pthread_mutex_unlock(&lpool.lock);
+  return n;
+}
+
+/* Jobs queued and not yet started, across every thread */
+int lpool_depth(void) {
+  long n = lpool_queued();
+  if (!__atomic_load_n(&lpool.started, __ATOMIC_ACQUIRE)) { return n; }
+  for (int i = 0; i < lpool_threads; i++) {
+    long d = __atomic_load_n(&lpool.q[i].bottom, __ATOMIC_RELAXED)
+      - __atomic_load_n(&lpool.q[i].top, __ATOMIC_RELAXED);
+    n += d > 0 ? d : 0;
+  }
+  return n;
+}
+
+/* Run n jobs and wait for all of them. While waiting the caller */
+/* runs its own jobs and steals others, so jobs may start jobs. */
+/* Each job starts with the fuel the caller has left, and the fuel */
+/* they use between them is taken from the caller once they're done */
+void lpool_run(ljob* jobs, int n) {
+  if (!__atomic_load_n(&lpool.started, __ATOMIC_ACQUIRE)
+      && lpool_size() > 1) {
+    lpool_start();
+  }
+  
+  if (lpool_threads == 1 || lpool_id < 0) {
+    int in_job = lpool_in_job;
+    lpool_in_job = 1;
+    for (int i = 0; i < n; i++) {
+      jobs[i].fuel = lfuel;
+      jobs[i].limit = lfuel_limit;
+      lpool_run_fueled(&jobs[i]);
+      lfuel -= jobs[i].fuel;
+    }
+    lpool_in_job = in_job;
+    return;
+  }
+  
+  /* Pushed last first, so the owner pops them in order */
+  int pending = n;
+  for (int i = n-1; i >= 0; i--) {
+    jobs[i].pending = &pending;
+    jobs[i].fuel = lfuel;
+    jobs[i].limit = lfuel_limit;
+    ldeque_push(&lpool.q[lpool_id], &jobs[i]);
+  }
+  lpool_wake();
+  
+  while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE)) {
+    int busy = 0;
+    ljob* j = lpool_find(&busy);
+    if (j) { lpool_exec(j); }
+    else if (!busy) { sched_yield(); }
+  }
+  for (int i = 0; i < n; i++) { lfuel -= jobs[i].fuel; }
+}
+
+/* Evaluation Machine */
+
+/* Evaluation keeps its place in frames on the heap rather than on */
+/* the C stack, so a task can stop part way and carry on later, on */
+/* any thread. The machine itself is under Evaluation */
+typedef struct lframe {
+  lval* v;  /* S-Expression whose cells are evaluated in place */
+  int i;    /* next cell to evaluate */
+  lval* fn; /* function being called, kept while the call is retried */
+  int pure; /* 1 pure, 0 impure, -1 not walked yet, see lpar_inherit */
+  int at;   /* depth of v along path, 0 for the frame that owns it */
+  int* path; /* cells leading to the first impure symbol, if impure */
+} lframe;
+
+typedef struct lmachine {
+  lenv* e;
+  int task;    /* calls may ask to be retried after a yield */
+  int resumed; /* set while a retried call is made again */
+  int heap;    /* frames were allocated, not lent by the caller */
+  int depth, cap;
+  lframe* frames;
+  lval* result;
+  int fd, events; /* what a retried call waits for, fd -1 if nothing */
+} lmachine;
+
+void lmachine_free(lmachine* m);
+lmachine* lmachine_new(lenv* e, lval* v);
+int lmachine_run(lmachine* m);
+
+/* The task whose call this thread is making, if any */
+__thread lmachine* lmachine_cur = NULL;
+
+/* Returned by builtins that can't go on yet inside a task. They */
+/* leave their arguments alone and are called again with them once */
+/* the task has yielded and been resumed */
+lval lval_retry;
+#define LVAL_RETRY (&lval_retry)
+
+/* Builtins */
+
+#define LASSERT(args, cond, fmt, ...) \
+  if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
+
+#define LASSERT_TYPE(func, args, index, expect) \
+  LASSERT(args, args->cell[index]->type == expect, \
+    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+
+#define LASSERT_NUM(func, args, num) \
+  LASSERT(args, args->count == num, \
+    "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
+    func, args->count, num)
+
+/* Pairs and Ropes are accepted anywhere a Q-Expression list is */
+#define LASSERT_LIST(func, args, index) \
+  LASSERT(args, args->cell[index]->type == LVAL_QEXPR \
+    || args->cell[index]->type == LVAL_PAIR \
+    || args->cell[index]->type == LVAL_ROPE, \
+    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+    func, index, ltype_name(args->cell[index]->type), ltype_name(LVAL_QEXPR))
+
+#define LASSERT_NOT_EMPTY(func, args, index) \
+  LASSERT(args, args->cell[index]->count != 0, \
+    "Function '%s' passed {} for argument %i.", func, index);
+
+
+lval* lval_eval(lenv* e, lval* v);
+
+lval* builtin_list(lenv* e, lval* a) {
+  a->type = LVAL_QEXPR;
+  return a;
+}
+
+lval* builtin_head(lenv* e, lval* a) {
+  LASSERT(a, a->count == 1,
+    "Function 'head' passed too many arguments.");
+  LASSERT(a, a->cell[0]->type == LVAL_QEXPR
+    || a->cell[0]->type == LVAL_PAIR
+    || a->cell[0]->type == LVAL_ROPE,
+    "Function 'head' passed incorrect type.");
+  LASSERT(a, a->cell[0]->count != 0,
+    "Function 'head' passed {}.");
+	
+	/* Move the first item into a fresh list rather than deleting the */
+	/* rest one at a time, which would copy them if v is shared */
+	lval* v = lval_take(a,0);
+	if (v->type == LVAL_PAIR) {
+		lval* x = lval_pair(lcons_new(lval_copy(v->pair->car), NULL), 1);
+		lval_del(v);
+		return x;
+	}
+	if (v->type == LVAL_ROPE) {
+		lval* x = lval_rope(lrope_slice(v->rope, 0, 1));
+		lval_del(v);
+		return x;
+	}
+	
+	lval* x = lval_pop(v,0);
+	lval_del(v);
+	return lval_add(lval_qexpr(), x);
+}
+
+lval* builtin_tail(lenv* e, lval* a) {
+  LASSERT_NUM("tail", a, 1);
+  LASSERT_LIST("tail", a, 0);
+  LASSERT_NOT_EMPTY("tail", a, 0);
+
+  lval* v = lval_take(a, 0);  
+  if (v->type == LVAL_PAIR) {
+    lcons* rest = v->pair->cdr;
+    if (rest) { LREF_INC(rest->refs); }
+    lval* x = lval_pair(rest, v->count-1);
+    lval_del(v);
+    return x;
+  }
+  if (v->type == LVAL_ROPE) {
+    lval* x = lval_rope(lrope_slice(v->rope, 1, v->count));
+    lval_del(v);
+    return x;
+  }
+
+  lval_del(lval_pop(v, 0));
+  return v;
+}
+
+/* The S-Expression eval was asked to evaluate, or an error */
+lval* builtin_eval_expr(lval* a) {
+  LASSERT_NUM("eval", a, 1);
+  LASSERT_LIST("eval", a, 0);
+  
+  lval* x = lval_flat(lval_take(a, 0));
+  x->type = LVAL_SEXPR;
+  return x;
+}
+
+lval* builtin_eval(lenv* e, lval* a) {
+  lval* x = builtin_eval_expr(a);
+  return x->type == LVAL_ERR ? x : lval_eval(e, x);
+}
+
+lval* builtin_join(lenv* e, lval* a) {
+  
+  int pairs = 0, ropes = 0;
+  for (int i = 0; i < a->count; i++) {
+    LASSERT_LIST("join", a, i);
+    pairs += a->cell[i]->type == LVAL_PAIR;
+    ropes += a->cell[i]->type == LVAL_ROPE;
+  }
+  
+  /* With any Rope in the mix the result is a Rope. Their trees are */
+  /* shared and joined in O(log n), other lists are made into Ropes */
+  if (ropes) {
+    lrope* t = NULL;
+    for (int i = 0; i < a->count; i++) {
+      if (a->cell[i]->type != LVAL_ROPE) {
+        a->cell[i] = lval_to_rope(lval_flat(a->cell[i]));
+      }
+      t = lrope_join(t, lrope_retain(a->cell[i]->rope));
+    }
+    lval_del(a);
+    return lval_rope(t);
+  }
+  
+  /* With any Pair in the mix the result is a Pair, built back to */
+  /* front so that the last argument's chain is shared, not copied */
+  if (pairs) {
+    int count = 0;
+    lcons* c = NULL;
+    while (a->count) {
+      lval* y = lval_pop(a, a->count-1);
+      count += y->count;
+      if (!c && y->type == LVAL_PAIR) {
+        c = y->pair;
+        y->pair = NULL;
+        lval_del(y);
+      } else {
+        c = lcons_append(y, c);
+      }
+    }
+    lval_del(a);
+    return lval_pair(c, count);
+  }
+  
+  lval* x = lval_pop(a, 0);
   
   while (a->count) {
     lval* y = lval_pop(a, 0);
     x = lval_join(x, y);
   }
   
-  lval_del(a);
-  return x;
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_cons(lenv* e, lval* a) {
+  LASSERT_NUM("cons", a, 2);
+  LASSERT_LIST("cons", a, 1);
+  
+  lval* x = lval_pop(a, 0);
+  lval* l = lval_take(a, 0);
+  
+  /* A Rope stays one, x going on the front as a leaf of its own */
+  if (l->type == LVAL_ROPE) {
+    lval* v = lval_rope(lrope_join(lrope_leaf(&x, 1), lrope_retain(l->rope)));
+    lval_del(l);
+    return v;
+  }
+  if (l->type == LVAL_QEXPR) { l = lval_to_pair(l); }
+  
+  /* Take over l's hold on its chain */
+  lval* v = lval_pair(lcons_new(x, l->pair), l->count+1);
+  l->pair = NULL;
+  lval_del(l);
+  return v;
+}
+
+lval* builtin_pair(lenv* e, lval* a) {
+  LASSERT_NUM("pair", a, 1);
+  LASSERT_LIST("pair", a, 0);
+  
+  lval* x = lval_take(a, 0);
+  return x->type == LVAL_PAIR ? x : lval_to_pair(lval_flat(x));
+}
+
+lval* builtin_rope(lenv* e, lval* a) {
+  LASSERT_NUM("rope", a, 1);
+  LASSERT_LIST("rope", a, 0);
+  
+  lval* x = lval_take(a, 0);
+  return x->type == LVAL_ROPE ? x : lval_to_rope(lval_flat(x));
+}
+
+/* Slow path of builtin_op once either side has outgrown a long */
+lval* lval_big_op(lval* x, lval* y, char op) {
+  lbig* a = x->type == LVAL_BIG ? x->big : lbig_from_long(x->num);
+  lbig* b = y->type == LVAL_BIG ? y->big : lbig_from_long(y->num);
+  
+  lbig* r = NULL;
+  switch (op) {
+    case '+': r = lbig_add(a, b, b->neg); break;
+    case '-': r = lbig_add(a, b, !b->neg); break;
+    case '*': r = lbig_mul(a, b); break;
+    case '/': r = lbig_div(a, b); break;
+  }
+  
+  if (x->type != LVAL_BIG) { free(a); }
+  if (y->type != LVAL_BIG) { free(b); }
+  lval_del(x); lval_del(y);
+  return lval_big(r);
+}
+
+/* Doubles beat integers of either size, so mixed operands become doubles */
+double lval_to_double(lval* v) {
+  switch (v->type) {
+    case LVAL_NUM: return v->num;
+    case LVAL_BIG: return lbig_to_double(v->big);
+    default: return v->dbl;
+  }
+}
+
+lval* lval_dbl_op(lval* x, lval* y, char op) {
+  double a = lval_to_double(x);
+  double b = lval_to_double(y);
+  lval_del(x); lval_del(y);
+  
+  switch (op) {
+    case '+': return lval_dbl(a + b);
+    case '-': return lval_dbl(a - b);
+    case '*': return lval_dbl(a * b);
+    default:  return lval_dbl(a / b);
+  }
+}
+
+/* Vector arithmetic. Scalars are broadcast to the length of the vectors */
+/* and integers are widened to doubles if any operand is a double */
+
+/* Take the elements out of v as a vector of the given type and length */
+lvec* lval_to_vec(lval* v, int dbl, int len) {
+  if (v->type == LVAL_VEC) {
+    lvec* x = v->vec;
+    v->vec = NULL;
+    if (x->dbl || !dbl) { return x; }
+    for (int i = 0; i < x->len; i++) { x->e[i].d = x->e[i].i; }
+    x->dbl = 1;
+    return x;
+  }
+  
+  lnum n;
+  if (dbl) { n.d = lval_to_double(v); } else { n.i = v->num; }
+  lvec* x = lvec_new(dbl, len);
+  for (int i = 0; i < len; i++) { x->e[i] = n; }
+  return x;
+}
+
+lval* lval_vec_op(lval* a, int op) {
+  int dbl = 0, len = -1;
+  for (int i = 0; i < a->count; i++) {
+    lval* x = a->cell[i];
+    if (x->type == LVAL_VEC) {
+      LASSERT(a, len == -1 || len == x->vec->len,
+        "Vector lengths differ. Got %i, Expected %i.", x->vec->len, len);
+      len = x->vec->len;
+      dbl |= x->vec->dbl;
+    }
+    dbl |= x->type == LVAL_DBL;
+  }
+  
+  for (int i = 0; i < a->count; i++) {
+    LASSERT(a, dbl || a->cell[i]->type != LVAL_BIG,
+      "Number too big for an integer vector.");
+  }
+  
+  lvec* x = lval_to_vec(a->cell[0], dbl, len);
+  
+  /* Unary minus */
+  if (a->count == 1 && op == LVEC_SUB) {
+    for (int i = 0; i < len; i++) {
+      if (dbl) { x->e[i].d = -x->e[i].d; continue; }
+      if (x->e[i].i == INT64_MIN) {
+        free(x);
+        lval_del(a);
+        return lval_err("Integer overflow in vector.");
+      }
+      x->e[i].i = -x->e[i].i;
+    }
+  }
+  
+  for (int i = 1; i < a->count; i++) {
+    lvec* y = lval_to_vec(a->cell[i], dbl, len);
+    int status = lvec_kernels[dbl][op](x->e, x->e, y->e, len);
+    free(y);
+    
+    if (status != LVEC_OK) {
+      free(x);
+      lval_del(a);
+      return lval_err(status == LVEC_DIV_ZERO
+        ? "Division By Zero." : "Integer overflow in vector.");
+    }
+  }
+  
+  /* Comparisons always give 0 or 1 */
+  if (op >= LVEC_LT) { x->dbl = 0; }
+  
+  lval_del(a);
+  return lval_vec(x);
+}
+
+lval* builtin_cmp(lenv* e, lval* a, char* func, int op) {
+  LASSERT_NUM(func, a, 2);
+  for (int i = 0; i < a->count; i++) {
+    int t = a->cell[i]->type;
+    LASSERT(a, t == LVAL_NUM || t == LVAL_BIG || t == LVAL_DBL || t == LVAL_VEC,
+      "Function '%s' passed incorrect type for argument %i. "
+      "Got %s, Expected %s.",
+      func, i, ltype_name(t), ltype_name(LVAL_VEC));
+  }
+  LASSERT(a, a->cell[0]->type == LVAL_VEC || a->cell[1]->type == LVAL_VEC,
+    "Function '%s' needs at least one Vector.", func);
+  return lval_vec_op(a, op);
+}
+
+lval* builtin_vlt(lenv* e, lval* a) { return builtin_cmp(e, a, "v<", LVEC_LT); }
+lval* builtin_vgt(lenv* e, lval* a) { return builtin_cmp(e, a, "v>", LVEC_GT); }
+lval* builtin_veq(lenv* e, lval* a) { return builtin_cmp(e, a, "v=", LVEC_EQ); }
+
+lval* builtin_reduce(lenv* e, lval* a, char* func, int op) {
+  LASSERT_NUM(func, a, 1);
+  LASSERT_TYPE(func, a, 0, LVAL_VEC);
+  LASSERT(a, a->cell[0]->vec->len != 0 || op == LVEC_ADD,
+    "Function '%s' passed an empty Vector.", func);
+  
+  lvec* v = a->cell[0]->vec;
+  lnum r;
+  int status = lvec_reducers[v->dbl][op](&r, v->e, v->len);
+  lval* x = status != LVEC_OK ? lval_err("Integer overflow in vector.")
+    : v->dbl ? lval_dbl(r.d) : lval_num(r.i);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_vsum(lenv* e, lval* a) { return builtin_reduce(e, a, "vsum", LVEC_ADD); }
+lval* builtin_vmin(lenv* e, lval* a) { return builtin_reduce(e, a, "vmin", LVEC_LT); }
+lval* builtin_vmax(lenv* e, lval* a) { return builtin_reduce(e, a, "vmax", LVEC_GT); }
+
+/* Build a matrix from a Q-Expression of equal length rows of numbers */
+lval* builtin_mat(lenv* e, lval* a) {
+  LASSERT_NUM("mat", a, 1);
+  LASSERT_TYPE("mat", a, 0, LVAL_QEXPR);
+  LASSERT_NOT_EMPTY("mat", a, 0);
+  
+  lval* q = a->cell[0];
+  for (int i = 0; i < q->count; i++) {
+    lval* row = q->cell[i];
+    LASSERT(a, row->type == LVAL_QEXPR,
+      "Function 'mat' passed non-row. Got %s, Expected %s.",
+      ltype_name(row->type), ltype_name(LVAL_QEXPR));
+    LASSERT(a, row->count != 0 && row->count == q->cell[0]->count,
+      "Function 'mat' passed rows of different lengths.");
+    for (int j = 0; j < row->count; j++) {
+      int t = row->cell[j]->type;
+      LASSERT(a, t == LVAL_NUM || t == LVAL_BIG || t == LVAL_DBL,
+        "Function 'mat' passed non-number. Got %s, Expected %s.",
+        ltype_name(t), ltype_name(LVAL_NUM));
+    }
+  }
+  
+  lmat* m = lmat_new(q->count, q->cell[0]->count);
+  for (int i = 0; i < m->rows; i++) {
+    for (int j = 0; j < m->cols; j++) {
+      m->at[i*m->rs + j] = lval_to_double(q->cell[i]->cell[j]);
+    }
+  }
+  lval_del(a);
+  return lval_mat(m);
+}
+
+lval* builtin_matmul(lenv* e, lval* a) {
+  LASSERT_NUM("matmul", a, 2);
+  LASSERT_TYPE("matmul", a, 0, LVAL_MAT);
+  LASSERT_TYPE("matmul", a, 1, LVAL_MAT);
+  
+  lmat* x = a->cell[0]->mat;
+  lmat* y = a->cell[1]->mat;
+  LASSERT(a, x->cols == y->rows,
+    "Function 'matmul' passed mismatched sizes. Got %ix%i and %ix%i.",
+    x->rows, x->cols, y->rows, y->cols);
+  
+  lval* r = lval_mat(lmat_mul(x, y));
+  lval_del(a);
+  return r;
+}
+
+/* Transposing just swaps the strides of a new view */
+lval* builtin_transpose(lenv* e, lval* a) {
+  LASSERT_NUM("transpose", a, 1);
+  LASSERT_TYPE("transpose", a, 0, LVAL_MAT);
+  
+  lmat* m = lmat_view(a->cell[0]->mat);
+  int rows = m->rows; m->rows = m->cols; m->cols = rows;
+  long rs = m->rs; m->rs = m->cs; m->cs = rs;
+  lval_del(a);
+  return lval_mat(m);
+}
+
+/* mslice m r0 r1 c0 c1 views rows r0 to r1 and columns c0 to c1, */
+/* including the starts and excluding the ends */
+lval* builtin_mslice(lenv* e, lval* a) {
+  LASSERT_NUM("mslice", a, 5);
+  LASSERT_TYPE("mslice", a, 0, LVAL_MAT);
+  for (int i = 1; i < 5; i++) {
+    LASSERT_TYPE("mslice", a, i, LVAL_NUM);
+  }
+  
+  lmat* m = a->cell[0]->mat;
+  long r0 = a->cell[1]->num, r1 = a->cell[2]->num;
+  long c0 = a->cell[3]->num, c1 = a->cell[4]->num;
+  LASSERT(a, 0 <= r0 && r0 <= r1 && r1 <= m->rows
+    && 0 <= c0 && c0 <= c1 && c1 <= m->cols,
+    "Function 'mslice' passed a range outside the %ix%i Matrix.",
+    m->rows, m->cols);
+  
+  lmat* v = lmat_view(m);
+  v->at += r0*m->rs + c0*m->cs;
+  v->rows = r1 - r0;
+  v->cols = c1 - c0;
+  lval_del(a);
+  return lval_mat(v);
+}
+
+/* Build a vector from a Q-Expression of numbers */
+lval* builtin_vec(lenv* e, lval* a) {
+  LASSERT_NUM("vec", a, 1);
+  LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+  
+  lval* q = a->cell[0];
+  int dbl = 0;
+  for (int i = 0; i < q->count; i++) {
+    int t = q->cell[i]->type;
+    LASSERT(a, t == LVAL_NUM || t == LVAL_DBL,
+      "Function 'vec' passed non-number. Got %s, Expected %s.",
+      ltype_name(t), ltype_name(LVAL_NUM));
+    dbl |= t == LVAL_DBL;
+  }
+  
+  lvec* v = lvec_new(dbl, q->count);
+  for (int i = 0; i < q->count; i++) {
+    if (dbl) { v->e[i].d = lval_to_double(q->cell[i]); }
+    else { v->e[i].i = q->cell[i]->num; }
+  }
+  lval_del(a);
+  return lval_vec(v);
+}
+
+lval* builtin_op(lenv* e, lval* a, char* op) {
+  
+  int vecs = 0;
+  for (int i = 0; i < a->count; i++) {
+    int t = a->cell[i]->type;
+    LASSERT(a, t == LVAL_NUM || t == LVAL_BIG || t == LVAL_DBL || t == LVAL_VEC,
+      "Function '%s' passed incorrect type for argument %i. "
+      "Got %s, Expected %s.",
+      op, i, ltype_name(a->cell[i]->type), ltype_name(LVAL_NUM));
+    vecs += t == LVAL_VEC;
+  }
+  
+  if (vecs) {
+    return lval_vec_op(a, strchr("+-*/", op[0]) - "+-*/");
+  }
+  
+  lval* x = lval_pop(a, 0);
+  
+  if ((strcmp(op, "-") == 0) && a->count == 0) {
+    if (x->type == LVAL_DBL) {
+      x->dbl = -x->dbl;
+    } else if (x->type == LVAL_BIG) {
+      x->big->neg = !x->big->neg;
+      lbig* b = x->big;
+      free(x);
+      x = lval_big(b);
+    } else if (x->num == LONG_MIN) {
+      lval_del(x);
+      x = lval_big(lbig_read("9223372036854775808"));
+    } else {
+      x->num = -x->num;
+    }
+  }
+  
+  while (a->count > 0) {  
+    lval* y = lval_pop(a, 0);
+    
+    if (op[0] == '/' && ((y->type == LVAL_NUM && y->num == 0)
+      || (y->type == LVAL_DBL && y->dbl == 0))) {
+      lval_del(x); lval_del(y);
+      x = lval_err("Division By Zero.");
+      break;
+    }
+    
+    /* Stay on machine words until a result overflows */
+    if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+      long r;
+      int overflow;
+      switch (op[0]) {
+        case '+': overflow = __builtin_add_overflow(x->num, y->num, &r); break;
+        case '-': overflow = __builtin_sub_overflow(x->num, y->num, &r); break;
+        case '*': overflow = __builtin_mul_overflow(x->num, y->num, &r); break;
+        default:
+          overflow = x->num == LONG_MIN && y->num == -1;
+          r = overflow ? 0 : x->num / y->num;
+      }
+      if (!overflow) {
+        x->num = r;
+        lval_del(y);
+        continue;
+      }
+    }
+    
+    if (x->type == LVAL_DBL || y->type == LVAL_DBL) {
+      x = lval_dbl_op(x, y, op[0]);
+    } else {
+      x = lval_big_op(x, y, op[0]);
+    }
+  }
+  
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_add(lenv* e, lval* a) {
+  return builtin_op(e, a, "+");
+}
+
+lval* builtin_sub(lenv* e, lval* a) {
+  return builtin_op(e, a, "-");
+}
+
+lval* builtin_mul(lenv* e, lval* a) {
+  return builtin_op(e, a, "*");
+}
+
+lval* builtin_div(lenv* e, lval* a) {
+  return builtin_op(e, a, "/");
+}
+
+lval* builtin_def(lenv* e, lval* a) {
+
+  LASSERT_TYPE("def", a, 0, LVAL_QEXPR);
+  LASSERT(a, !lpool_in_job,
+    "Function 'def' can't be used inside pmap, preduce or future.");
+  
+  /* First argument is symbol list */
+  lval* syms = a->cell[0];
+  
+  /* Ensure all elements of first list are symbols */
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+      "Function 'def' cannot define non-symbol. "
+      "Got %s, Expected %s.",
+      ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+  }
+  
+  /* Check correct number of symbols and values */
+  LASSERT(a, (syms->count == a->count-1),
+    "Function 'def' passed too many arguments for symbols. "
+    "Got %i, Expected %i.",
+    syms->count, a->count-1);
+  
+  /* Assign copies of values to symbols */
+  for (int i = 0; i < syms->count; i++) {
+    lenv_put(e, syms->cell[i], a->cell[i+1]);
+  }
+  
+  lval_del(a);
+  return lval_sexpr();
+}
+
+/* pmap and preduce hand out LPOOL_CHUNK items per job. The chunks */
+/* don't depend on the thread count, and neither do the results */
+#define LPOOL_CHUNK 64
+
+typedef struct lchunk {
+  lenv* e;
+  lval* f;
+  lval** items;
+  int n;
+  lval* out; /* preduce only */
+} lchunk;
+
+lval* lval_call(lenv* e, lval* f, lval* x, lval* y) {
+  lval* args = lval_add(lval_sexpr(), x);
+  if (y) { lval_add(args, y); }
+  
+  /* Nothing here could yield on behalf of a task */
+  lmachine* cur = lmachine_cur;
+  lmachine_cur = NULL;
+  lval* r = f->fun(e, args);
+  lmachine_cur = cur;
+  return r;
+}
+
+/* Replace each item with f applied to it */
+void lchunk_map(void* arg) {
+  lchunk* c = arg;
+  for (int i = 0; i < c->n; i++) {
+    c->items[i] = lval_call(c->e, c->f, c->items[i], NULL);
+  }
+}
+
+/* Fold the items left to right with f, stopping at the first error */
+void lchunk_reduce(void* arg) {
+  lchunk* c = arg;
+  lval* x = c->items[0];
+  for (int i = 1; i < c->n; i++) {
+    if (x->type == LVAL_ERR) { lval_del(c->items[i]); continue; }
+    x = lval_call(c->e, c->f, x, c->items[i]);
+  }
+  c->out = x;
+}
+
+/* Pull the items out of a list or vector into a plain array */
+lval** lval_items(lval* v, int* n) {
+  if (v->type == LVAL_VEC) {
+    *n = v->vec->len;
+    lval** items = malloc(sizeof(lval*) * (*n ? *n : 1));
+    for (int i = 0; i < *n; i++) {
+      items[i] = v->vec->dbl ? lval_dbl(v->vec->e[i].d) : lval_num(v->vec->e[i].i);
+    }
+    return items;
+  }
+  
+  lval_own(v);
+  *n = v->count;
+  lval** items = malloc(sizeof(lval*) * (*n ? *n : 1));
+  memcpy(items, v->cell, sizeof(lval*) * *n);
+  v->count = 0;
+  return items;
+}
+
+/* Split items into chunks and run each through the pool */
+lchunk* lval_chunks(lenv* e, lval* f, lval** items, int n, int* nchunks,
+                    void (*run)(void*)) {
+  *nchunks = (n + LPOOL_CHUNK - 1) / LPOOL_CHUNK;
+  lchunk* chunks = malloc(sizeof(lchunk) * (*nchunks ? *nchunks : 1));
+  ljob* jobs = malloc(sizeof(ljob) * (*nchunks ? *nchunks : 1));
+  for (int i = 0; i < *nchunks; i++) {
+    chunks[i].e = e;
+    chunks[i].f = f;
+    chunks[i].items = items + i * LPOOL_CHUNK;
+    chunks[i].n = n - i * LPOOL_CHUNK < LPOOL_CHUNK ? n - i * LPOOL_CHUNK : LPOOL_CHUNK;
+    jobs[i].run = run;
+    jobs[i].arg = &chunks[i];
+  }
+  lpool_run(jobs, *nchunks);
+  free(jobs);
+  return chunks;
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+  LASSERT_NUM("pmap", a, 2);
+  LASSERT_TYPE("pmap", a, 0, LVAL_FUN);
+  LASSERT(a, a->cell[1]->type == LVAL_QEXPR || a->cell[1]->type == LVAL_VEC,
+    "Function 'pmap' passed incorrect type for argument 1. "
+    "Got %s, Expected %s.",
+    ltype_name(a->cell[1]->type), ltype_name(LVAL_QEXPR));
+  
+  int vec = a->cell[1]->type == LVAL_VEC, n, nchunks;
+  lval** items = lval_items(a->cell[1], &n);
+  free(lval_chunks(e, a->cell[0], items, n, &nchunks, lchunk_map));
+  
+  /* Results stay in input order, and the first error wins */
+  lval* x = lval_qexpr();
+  for (int i = 0; i < n; i++) {
+    if (x->type != LVAL_ERR && items[i]->type == LVAL_ERR) {
+      lval_del(x);
+      x = items[i];
+      continue;
+    }
+    if (x->type == LVAL_ERR) { lval_del(items[i]); continue; }
+    lval_add(x, items[i]);
+  }
+  free(items);
+  lval_del(a);
+  
+  /* A vector maps back to a vector */
+  if (vec && x->type != LVAL_ERR) {
+    return builtin_vec(e, lval_add(lval_sexpr(), x));
+  }
+  return x;
+}
+
+lval* builtin_preduce(lenv* e, lval* a) {
+  LASSERT_NUM("preduce", a, 2);
+  LASSERT_TYPE("preduce", a, 0, LVAL_FUN);
+  LASSERT(a, a->cell[1]->type == LVAL_QEXPR || a->cell[1]->type == LVAL_VEC,
+    "Function 'preduce' passed incorrect type for argument 1. "
+    "Got %s, Expected %s.",
+    ltype_name(a->cell[1]->type), ltype_name(LVAL_QEXPR));
+  
+  lval* l = a->cell[1];
+  LASSERT(a, (l->type == LVAL_VEC ? l->vec->len : l->count) != 0,
+    "Function 'preduce' passed {} for argument 1.");
+  
+  int n, nchunks;
+  lval** items = lval_items(l, &n);
+  lchunk* chunks = lval_chunks(e, a->cell[0], items, n, &nchunks, lchunk_reduce);
+  
+  /* Chunk results are combined in order on this thread */
+  lval* x = chunks[0].out;
+  for (int i = 1; i < nchunks; i++) {
+    if (x->type == LVAL_ERR) { lval_del(chunks[i].out); continue; }
+    if (chunks[i].out->type == LVAL_ERR) { lval_del(x); x = chunks[i].out; continue; }
+    x = lval_call(e, a->cell[0], x, chunks[i].out);
+  }
+  free(chunks);
+  free(items);
+  lval_del(a);
+  return x;
+}
+
+/* Futures */
+
+enum { LFUT_PENDING, LFUT_RUNNING, LFUT_DONE, LFUT_CANCELLED };
+
+struct lfut {
+  int refs;
+  int state;
+  int cancel; /* asks a running future to stop at its next call */
+  lenv* e;
+  lval* expr; /* S-Expression still to evaluate while pending */
+  lval* result; /* set once done */
+  lfut* waits; /* future this one is blocked on, guarded by lfut_lock */
+  lmachine* task; /* spawned tasks keep their place here between slices */
+  lfut* io_next; /* next task parked on the same fd, guarded by lio.lock */
+  long fuel; /* for each evaluation, or slice of a task */
+  ljob job;
+};
+
+/* The future whose expression this thread is evaluating, checked */
+/* for cancelling. Argument jobs carry it to the thread running them */
+__thread lfut* lfut_cur = NULL;
+
+/* The innermost future running on this thread's stack. Anything */
+/* this thread blocks on blocks that future too */
+__thread lfut* lfut_top = NULL;
+
+/* Guards the waits links and wakes threads awaiting a future */
+pthread_mutex_t lfut_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t lfut_done = PTHREAD_COND_INITIALIZER;
+
+/* Threads in lfut_drive, which also want waking when a task yields */
+int lfut_waiters = 0;
+
+lfut* lfut_retain(lfut* f) {
+  LREF_INC(f->refs);
+  return f;
+}
+
+void lfut_release(lfut* f) {
+  if (LREF_DEC(f->refs) > 0) { return; }
+  if (f->expr) { lval_del(f->expr); }
+  if (f->result) { lval_del(f->result); }
+  if (f->task) { lmachine_free(f->task); }
+  lenv_release(f->e);
+  free(f);
+}
+
+int lfut_state(lfut* f) {
+  return __atomic_load_n(&f->state, __ATOMIC_ACQUIRE);
+}
+
+void lval_fut_print(lfut* f) {
+  char* names[] = { "pending", "running", "done", "cancelled" };
+  fprintf(LOUT, "<future %s>", names[lfut_state(f)]);
+}
+
+/* Mark lfut_top as blocked on f, unless f is already blocked on it */
+/* some way round, when waiting would never end. Lock must be held */
+int lfut_block(lfut* f) {
+  if (!lfut_top) { return 1; }
+  for (lfut* w = f; w; w = w->waits) {
+    if (w == lfut_top) { return 0; }
+  }
+  lfut_top->waits = f;
+  return 1;
+}
+
+void lfut_unblock(void) {
+  if (lfut_top) { lfut_top->waits = NULL; }
+}
+
+/* Evaluate f on this thread if nobody has started it yet. Tasks */
+/* are only ever run a slice at a time from the queue */
+void lfut_force(lfut* f) {
+  if (f->task) { return; }
+  
+  int s = LFUT_PENDING;
+  if (!__atomic_compare_exchange_n(&f->state, &s, LFUT_RUNNING, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  
+  pthread_mutex_lock(&lfut_lock);
+  lfut_block(f);
+  pthread_mutex_unlock(&lfut_lock);
+  
+  lfut* cur = lfut_cur;
+  lfut* top = lfut_top;
+  int in_job = lpool_in_job;
+  long fuel = lfuel, limit = lfuel_limit;
+  lfut_cur = lfut_top = f;
+  lpool_in_job = 1;
+  lfuel_fill(f->fuel);
+  
+  lval* x = f->expr;
+  f->expr = NULL;
+  f->result = lval_eval(f->e, x);
+  
+  lpool_in_job = in_job;
+  lfut_cur = cur;
+  lfut_top = top;
+  lfuel = fuel;
+  lfuel_limit = limit;
+  
+  pthread_mutex_lock(&lfut_lock);
+  lfut_unblock();
+  __atomic_store_n(&f->state, LFUT_DONE, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&lfut_done);
+  pthread_mutex_unlock(&lfut_lock);
+}
+
+void lfut_run(void* f) {
+  lfut_force(f);
+  lfut_release(f);
+}
+
+lfut* lfut_new(lenv* e, void (*run)(void*)) {
+  lfut* f = malloc(sizeof(lfut));
+  f->refs = 1;
+  f->state = LFUT_PENDING;
+  f->cancel = 0;
+  f->e = lenv_retain(e);
+  f->expr = NULL;
+  f->result = NULL;
+  f->waits = NULL;
+  f->task = NULL;
+  f->io_next = NULL;
+  f->fuel = lfuel_limit;
+  f->job.run = run;
+  f->job.arg = f;
+  f->job.pending = NULL;
+  return f;
+}
+
+/* Wake threads in lfut_drive after a task went back on the queue */
+void lfut_wake(void) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&lfut_waiters, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&lfut_lock);
+    pthread_cond_broadcast(&lfut_done);
+    pthread_mutex_unlock(&lfut_lock);
+  }
+}
+
+/* Wait for task f, running queued jobs meanwhile. With one thread */
+/* this is the only thing that runs tasks at all */
+void lfut_drive(lfut* f) {
+  while (lfut_state(f) < LFUT_DONE) {
+    ljob* j = lpool_take();
+    if (j) { lpool_exec(j); continue; }
+    
+    /* Tasks parked on I/O need somebody running the event loop */
+    if (lio_claim()) {
+      if (lfut_state(f) < LFUT_DONE && !lpool_queued()) { lio_poll(-1); }
+      lio_unclaim();
+      continue;
+    }
+    
+    pthread_mutex_lock(&lfut_lock);
+    __atomic_add_fetch(&lfut_waiters, 1, __ATOMIC_SEQ_CST);
+    if (lfut_state(f) < LFUT_DONE && !lpool_queued()) {
+      pthread_cond_wait(&lfut_done, &lfut_lock);
+    }
+    __atomic_sub_fetch(&lfut_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lfut_lock);
+  }
+}
+
+lval* builtin_future(lenv* e, lval* a) {
+  LASSERT_NUM("future", a, 1);
+  LASSERT_LIST("future", a, 0);
+  
+  lval* x = lval_flat(lval_take(a, 0));
+  x->type = LVAL_SEXPR;
+  
+  lfut* f = lfut_new(e, lfut_run);
+  f->expr = x;
+  
+  /* With no other threads the future is left to run when awaited */
+  if (lpool_size() > 1) { lpool_spawn(&lfut_retain(f)->job); }
+  return lval_fut(f);
+}
+
+lval* builtin_await(lenv* e, lval* a) {
+  LASSERT_NUM("await", a, 1);
+  LASSERT_TYPE("await", a, 0, LVAL_FUT);
+  
+  lfut* f = a->cell[0]->fut;
+  LASSERT(a, f != lfut_cur, "Future awaits itself.");
+  
+  /* A future nobody has started yet is run here and now */
+  lfut_force(f);
+  
+  /* A task yields until f is done instead of blocking its thread */
+  if (lmachine_cur && lfut_state(f) < LFUT_DONE) { return LVAL_RETRY; }
+  
+  if (f->task) {
+    lfut_drive(f);
+  } else if (lfut_state(f) == LFUT_RUNNING) {
+    pthread_mutex_lock(&lfut_lock);
+    if (!lfut_block(f)) {
+      pthread_mutex_unlock(&lfut_lock);
+      lval_del(a);
+      return lval_err("Future awaits itself.");
+    }
+    while (lfut_state(f) == LFUT_RUNNING) {
+      pthread_cond_wait(&lfut_done, &lfut_lock);
+    }
+    lfut_unblock();
+    pthread_mutex_unlock(&lfut_lock);
+  }
+  
+  lval* x = lfut_state(f) == LFUT_CANCELLED
+    ? lval_err("Future was cancelled.") : lval_copy(f->result);
+  lval_del(a);
+  return x;
+}
+
+/* Returns 1 if the future hadn't finished. A running future stops */
+/* at its next call and awaits to the cancelled error */
+lval* builtin_cancel(lenv* e, lval* a) {
+  LASSERT_NUM("cancel", a, 1);
+  LASSERT_TYPE("cancel", a, 0, LVAL_FUT);
+  
+  lfut* f = a->cell[0]->fut;
+  __atomic_store_n(&f->cancel, 1, __ATOMIC_RELAXED);
+  int s = LFUT_PENDING;
+  int stopped = __atomic_compare_exchange_n(&f->state, &s, LFUT_CANCELLED,
+    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || s == LFUT_RUNNING;
+  
+  lval_del(a);
+  return lval_num(stopped);
+}
+
+/* Takes {}, since a call needs an argument */
+lval* builtin_queued(lenv* e, lval* a) {
+  LASSERT_NUM("queued", a, 1);
+  lval_del(a);
+  return lval_num(lpool_depth());
+}
+
+/* Channels */
+
+/* A bounded queue any number of threads can send to and receive */
+/* from at once. Each slot has a sequence number saying whose turn it */
+/* is, after Vyukov's bounded MPMC queue. Sequences step by two so */
+/* a one slot channel still tells full from empty: slot i holds */
+/* 2*pos when free for the send at pos and 2*pos+1 once filled */
+typedef struct lslot {
+  long seq;
+  lval* v;
+} lslot;
+
+struct lchan {
+  int refs;
+  long cap;
+  int sleepers; /* threads blocked on this channel */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  char pad0[64];
+  long head; /* next position to send to */
+  char pad1[64];
+  long tail; /* next position to receive from */
+  char pad2[64];
+  lslot slot[];
+};
+
+/* Threads blocked in select, which sleep on lchan_wake */
+int lchan_selecting = 0;
+pthread_mutex_t lchan_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t lchan_wake = PTHREAD_COND_INITIALIZER;
+
+lchan* lchan_new(long cap) {
+  lchan* c = calloc(1, sizeof(lchan) + sizeof(lslot) * cap);
+  c->refs = 1;
+  c->cap = cap;
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->wake, NULL);
+  for (long i = 0; i < cap; i++) { c->slot[i].seq = 2*i; }
+  return c;
+}
+
+lchan* lchan_retain(lchan* c) {
+  LREF_INC(c->refs);
+  return c;
+}
+
+lval* lchan_try_recv(lchan* c);
+
+void lchan_release(lchan* c) {
+  if (LREF_DEC(c->refs) > 0) { return; }
+  for (lval* v; (v = lchan_try_recv(c)); ) { lval_del(v); }
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->wake);
+  free(c);
+}
+
+/* Move v into c, or return 0 if it is full */
+int lchan_try_send(lchan* c, lval* v) {
+  long pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+  lslot* s;
+  while (1) {
+    s = &c->slot[pos % c->cap];
+    long d = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - 2*pos;
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&c->head, &pos, pos+1, 1,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { break; }
+    } else if (d < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+    }
+  }
+  s->v = v;
+  __atomic_store_n(&s->seq, 2*pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Take the oldest value out of c, or NULL if it is empty */
+lval* lchan_try_recv(lchan* c) {
+  long pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+  lslot* s;
+  while (1) {
+    s = &c->slot[pos % c->cap];
+    long d = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - (2*pos + 1);
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&c->tail, &pos, pos+1, 1,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { break; }
+    } else if (d < 0) {
+      return NULL;
+    } else {
+      pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+    }
+  }
+  lval* v = s->v;
+  __atomic_store_n(&s->seq, 2*(pos + c->cap), __ATOMIC_RELEASE);
+  return v;
+}
+
+/* Wake anything blocked on c, now a value or a slot has turned up. */
+/* Sleepers count themselves before trying once more under the */
+/* lock, so either they see this change or we see them */
+void lchan_notify(lchan* c) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&c->sleepers, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&c->lock);
+    pthread_cond_broadcast(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+  }
+  if (__atomic_load_n(&lchan_selecting, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&lchan_lock);
+    pthread_cond_broadcast(&lchan_wake);
+    pthread_mutex_unlock(&lchan_lock);
+  }
+}
+
+/* Tries before a blocked thread goes to sleep */
+#define LCHAN_SPIN 64
+
+void lchan_send(lchan* c, lval* v) {
+  for (int i = 0; !lchan_try_send(c, v); i++) {
+    if (i < LCHAN_SPIN) { sched_yield(); continue; }
+    pthread_mutex_lock(&c->lock);
+    __atomic_add_fetch(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+    int sent = lchan_try_send(c, v);
+    if (!sent) { pthread_cond_wait(&c->wake, &c->lock); }
+    __atomic_sub_fetch(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&c->lock);
+    if (sent) { break; }
+  }
+  lchan_notify(c);
+}
+
+lval* lchan_recv(lchan* c) {
+  lval* v;
+  for (int i = 0; !(v = lchan_try_recv(c)); i++) {
+    if (i < LCHAN_SPIN) { sched_yield(); continue; }
+    pthread_mutex_lock(&c->lock);
+    __atomic_add_fetch(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+    v = lchan_try_recv(c);
+    if (!v) { pthread_cond_wait(&c->wake, &c->lock); }
+    __atomic_sub_fetch(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&c->lock);
+    if (v) { break; }
+  }
+  lchan_notify(c);
+  return v;
+}
+
+/* Receive from the first of n channels with a value, starting the */
+/* scan at a different one each time so none is starved */
+lval* lchan_select(lchan** cs, int n, int* which) {
+  static __thread unsigned start = 0;
+  start++;
+  for (int i = 0; ; i++) {
+    for (int k = 0; k < n; k++) {
+      *which = (start + k) % n;
+      lval* v = lchan_try_recv(cs[*which]);
+      if (v) { lchan_notify(cs[*which]); return v; }
+    }
+    if (i < LCHAN_SPIN) { sched_yield(); continue; }
+    
+    pthread_mutex_lock(&lchan_lock);
+    __atomic_add_fetch(&lchan_selecting, 1, __ATOMIC_SEQ_CST);
+    lval* v = NULL;
+    for (int k = 0; k < n && !v; k++) {
+      *which = (start + k) % n;
+      v = lchan_try_recv(cs[*which]);
+    }
+    if (!v) { pthread_cond_wait(&lchan_wake, &lchan_lock); }
+    __atomic_sub_fetch(&lchan_selecting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lchan_lock);
+    if (v) { lchan_notify(cs[*which]); return v; }
+  }
+}
+
+void lval_chan_print(lchan* c) {
+  long n = __atomic_load_n(&c->head, __ATOMIC_RELAXED)
+    - __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+  fprintf(LOUT, "<channel %li/%li>", n < 0 ? 0 : n > c->cap ? c->cap : n, c->cap);
+}
+
+lval* builtin_chan(lenv* e, lval* a) {
+  LASSERT_NUM("chan", a, 1);
+  LASSERT_TYPE("chan", a, 0, LVAL_NUM);
+  LASSERT(a, a->cell[0]->num > 0 && a->cell[0]->num <= INT_MAX,
+    "Function 'chan' passed invalid capacity %li.", a->cell[0]->num);
+  
+  long cap = a->cell[0]->num;
+  lval_del(a);
+  return lval_chan(lchan_new(cap));
+}
+
+/* The value is moved into the channel as it is, not copied */
+lval* builtin_send(lenv* e, lval* a) {
+  LASSERT_NUM("send", a, 2);
+  LASSERT_TYPE("send", a, 0, LVAL_CHAN);
+  
+  lchan* c = a->cell[0]->chan;
+  lval* v = lval_pop(a, 1);
+  if (lchan_try_send(c, v)) {
+    lchan_notify(c);
+    lval_del(a);
+    return lval_sexpr();
+  }
+  
+  /* A task yields until there is room */
+  if (lmachine_cur) {
+    lval_add(a, v);
+    return LVAL_RETRY;
+  }
+  
+  if (lpool_size() == 1) {
+    lval_del(v);
+    lval_del(a);
+    return lval_err("Function 'send' would block forever with only one thread.");
+  }
+  
+  lchan_retain(c);
+  lval_del(a);
+  lchan_send(c, v);
+  lchan_release(c);
+  return lval_sexpr();
+}
+
+lval* builtin_recv(lenv* e, lval* a) {
+  LASSERT_NUM("recv", a, 1);
+  LASSERT_TYPE("recv", a, 0, LVAL_CHAN);
+  
+  lchan* c = a->cell[0]->chan;
+  lval* v = lchan_try_recv(c);
+  if (v) { lchan_notify(c); lval_del(a); return v; }
+  if (lmachine_cur) { return LVAL_RETRY; }
+  
+  /* With one thread nothing else could ever send */
+  LASSERT(a, lpool_size() > 1,
+    "Function 'recv' would block forever with only one thread.");
+  v = lchan_recv(c);
+  lval_del(a);
+  return v;
+}
+
+/* Returns {i v} for a value v taken from the i-th channel */
+lval* builtin_select(lenv* e, lval* a) {
+  LASSERT_NUM("select", a, 1);
+  LASSERT_TYPE("select", a, 0, LVAL_QEXPR);
+  LASSERT_NOT_EMPTY("select", a, 0);
+  
+  lval* l = a->cell[0];
+  for (int i = 0; i < l->count; i++) {
+    LASSERT(a, l->cell[i]->type == LVAL_CHAN,
+      "Function 'select' passed incorrect type in argument 0. "
+      "Got %s, Expected %s.",
+      ltype_name(l->cell[i]->type), ltype_name(LVAL_CHAN));
+  }
+  
+  /* Counts are never negative, but say so before sizing the copy */
+  LASSERT(a, l->count > 0, "Function 'select' passed {} for argument 0.");
+  lchan** cs = malloc(sizeof(lchan*) * (size_t)l->count);
+  for (int i = 0; i < l->count; i++) { cs[i] = l->cell[i]->chan; }
+  
+  int which;
+  lval* v = NULL;
+  for (int k = 0; k < l->count && !v; k++) {
+    which = k;
+    v = lchan_try_recv(cs[k]);
+  }
+  if (v) {
+    lchan_notify(cs[which]);
+  } else if (lmachine_cur) {
+    free(cs);
+    return LVAL_RETRY;
+  } else if (lpool_size() > 1) {
+    v = lchan_select(cs, l->count, &which);
+  }
+  free(cs);
+  LASSERT(a, v, "Function 'select' would block forever with only one thread.");
+  
+  lval_del(a);
+  return lval_add(lval_add(lval_qexpr(), lval_num(which)), v);
+}
+
+/* Event Loop */
+
+/* A task that would block reading or writing a file descriptor is */
+/* parked on it instead of going back on the queue, and an epoll */
+/* instance says when to wake it. The loop has no thread of its own. */
+/* Whichever thread would otherwise sleep, an idle pool thread, an */
+/* await or the REPL prompt, runs it while tasks are parked. Without */
+/* epoll, every parked fd is handed to poll each time round instead */
+struct {
+  int ep;       /* the epoll instance, -1 without epoll */
+  int wake[2];  /* read and write ends of what is written to interrupt */
+                /* a poll: one eventfd in ep, or else a pipe */
+  lfut** waits; /* tasks parked on each fd, linked through io_next */
+  int cap;
+  int parked;
+  int polling;  /* set while a thread owns the loop */
+  struct pollfd* polls; /* without epoll, what the owner polls */
+  pthread_mutex_t lock;
+} lio = { -1, { -1, -1 }, NULL, 0, 0, 0, NULL, PTHREAD_MUTEX_INITIALIZER };
+
+pthread_once_t lio_once = PTHREAD_ONCE_INIT;
+
+void lio_init(void) {
+#ifdef LIO_EPOLL
+  lio.ep = epoll_create1(EPOLL_CLOEXEC);
+  lio.wake[0] = lio.wake[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = lio.wake[0];
+  epoll_ctl(lio.ep, EPOLL_CTL_ADD, lio.wake[0], &ev);
+#else
+  if (pipe(lio.wake) != 0) { return; }
+  for (int i = 0; i < 2; i++) {
+    fcntl(lio.wake[i], F_SETFL, fcntl(lio.wake[i], F_GETFL) | O_NONBLOCK);
+    fcntl(lio.wake[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+}
+
+/* Become the thread running the loop, if any task is parked and */
+/* nobody else is running it */
+int lio_claim(void) {
+  if (!__atomic_load_n(&lio.parked, __ATOMIC_SEQ_CST)) { return 0; }
+  int idle = 0;
+  return __atomic_compare_exchange_n(&lio.polling, &idle, 1, 0,
+    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+void lio_unclaim(void) {
+  __atomic_store_n(&lio.polling, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Interrupt the thread polling, now there's something else for it */
+/* to do. It claimed the loop before checking, so either it sees */
+/* the change or we see it polling */
+void lio_poke(void) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&lio.polling, __ATOMIC_RELAXED)) {
+    uint64_t one = 1;
+    if (write(lio.wake[1], &one, sizeof(one)) < 0) { /* already set */ }
+  }
+}
+
+/* Put every task parked on fd back on the queue. They try again, */
+/* and park again if fd still isn't ready for them */
+void lio_wake(int fd) {
+  pthread_mutex_lock(&lio.lock);
+  lfut* f = NULL;
+  if (fd >= 0 && fd < lio.cap) {
+    f = lio.waits[fd];
+    lio.waits[fd] = NULL;
+  }
+  for (lfut* w = f; w; w = w->io_next) {
+    __atomic_sub_fetch(&lio.parked, 1, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&lio.lock);
+  
+  if (!f) { return; }
+  while (f) {
+    lfut* next = f->io_next; /* f may park again as soon as it's queued */
+    lpool_spawn(&f->job);
+    f = next;
+  }
+  lfut_wake();
+}
+
+/* Park task f on the fd its machine is waiting for, taking over */
+/* its queue reference. The fd is watched one-shot, for what all of */
+/* its tasks want, and rearmed on each park so none can be missed */
+void lio_park(lfut* f) {
+  pthread_once(&lio_once, lio_init);
+  int fd = f->task->fd;
+  f->task->fd = -1;
+  
+  pthread_mutex_lock(&lio.lock);
+  if (fd >= lio.cap) {
+    int cap = lio.cap ? lio.cap : 64;
+    while (cap <= fd) { cap *= 2; }
+    lio.waits = realloc(lio.waits, sizeof(lfut*) * cap);
+    memset(lio.waits + lio.cap, 0, sizeof(lfut*) * (cap - lio.cap));
+    lio.cap = cap;
+  }
+  f->io_next = lio.waits[fd];
+  lio.waits[fd] = f;
+  __atomic_add_fetch(&lio.parked, 1, __ATOMIC_SEQ_CST);
+  
+#ifdef LIO_EPOLL
+  struct epoll_event ev;
+  ev.events = EPOLLONESHOT;
+  ev.data.fd = fd;
+  for (lfut* w = f; w; w = w->io_next) {
+    if (w->task->events & POLLIN)  { ev.events |= EPOLLIN; }
+    if (w->task->events & POLLOUT) { ev.events |= EPOLLOUT; }
+  }
+  int ok = epoll_ctl(lio.ep, EPOLL_CTL_MOD, fd, &ev) == 0
+    || (errno == ENOENT && epoll_ctl(lio.ep, EPOLL_CTL_ADD, fd, &ev) == 0);
+  pthread_mutex_unlock(&lio.lock);
+  
+  /* An fd epoll can't watch is woken to find out why */
+  if (!ok) { lio_wake(fd); }
+#else
+  pthread_mutex_unlock(&lio.lock);
+  
+  /* A poll already going doesn't have fd, so it starts again */
+  lio_poke();
+#endif
+}
+
+/* Empty the wakeup eventfd or pipe */
+void lio_drain(void) {
+  uint64_t x[8];
+  if (read(lio.wake[0], x, sizeof(x)) < 0) { /* already cleared */ }
+}
+
+#ifdef LIO_EPOLL
+
+/* Wait up to timeout ms, or until poked, for parked fds to become */
+/* ready, and wake their tasks */
+void lio_poll(int timeout) {
+  struct epoll_event evs[64];
+  int n = epoll_wait(lio.ep, evs, 64, timeout);
+  for (int i = 0; i < n; i++) {
+    if (evs[i].data.fd == lio.wake[0]) { lio_drain(); continue; }
+    lio_wake(evs[i].data.fd);
+  }
+}
+
+#else
+
+/* The same with poll, watching fd for events as well if it isn't -1. */
+/* Parked fds are gathered afresh each time, as waking takes them out */
+void lio_poll_with(int fd, int events, int timeout) {
+  pthread_mutex_lock(&lio.lock);
+  lio.polls = realloc(lio.polls, sizeof(struct pollfd) * (lio.cap + 2));
+  struct pollfd* p = lio.polls;
+  p[0].fd = lio.wake[0]; p[0].events = POLLIN;
+  p[1].fd = fd; p[1].events = events;
+  int n = 2;
+  for (int i = 0; i < lio.cap; i++) {
+    if (!lio.waits[i]) { continue; }
+    p[n].fd = i;
+    p[n].events = 0;
+    for (lfut* w = lio.waits[i]; w; w = w->io_next) { p[n].events |= w->task->events; }
+    n++;
+  }
+  pthread_mutex_unlock(&lio.lock);
+  
+  for (int i = 0; i < n; i++) { p[i].revents = 0; }
+  if (poll(p, n, timeout) <= 0) { return; }
+  if (p[0].revents) { lio_drain(); }
+  for (int i = 2; i < n; i++) {
+    if (p[i].revents) { lio_wake(p[i].fd); }
+  }
+}
+
+void lio_poll(int timeout) {
+  lio_poll_with(-1, 0, timeout);
+}
+
+#endif
+
+int lio_ready(int fd, int events) {
+  struct pollfd p = { fd, events, 0 };
+  return poll(&p, 1, 0) != 0;
+}
+
+/* Wait for fd outside any task. Until it's ready this thread runs */
+/* queued tasks and the event loop, so waiting holds nothing up */
+void lio_wait(int fd, int events) {
+  while (!lio_ready(fd, events)) {
+    /* Spawned jobs may block, which a job mustn't */
+    ljob* j = lpool_in_job ? NULL : lpool_take();
+    if (j) { lpool_exec(j); continue; }
+    
+    int claimed = lio_claim();
+    if (claimed && lpool_queued()) { lio_unclaim(); continue; }
+#ifdef LIO_EPOLL
+    struct pollfd p[2] = { { fd, events, 0 }, { lio.ep, POLLIN, 0 } };
+    poll(p, claimed ? 2 : 1, -1);
+    if (claimed) {
+      if (p[1].revents) { lio_poll(0); }
+      lio_unclaim();
+    }
+#else
+    if (claimed) {
+      lio_poll_with(fd, events, -1);
+      lio_unclaim();
+    } else {
+      struct pollfd p = { fd, events, 0 };
+      poll(&p, 1, -1);
+    }
+#endif
+  }
+}
+
+/* Returns 1 once fd is ready. A task is instead left waiting on fd, */
+/* and 0 returned for its call to give LVAL_RETRY */
+int lio_await(int fd, int events) {
+  if (lio_ready(fd, events)) { return 1; }
+  if (lmachine_cur) {
+    lmachine_cur->fd = fd;
+    lmachine_cur->events = events;
+    return 0;
+  }
+  lio_wait(fd, events);
+  return 1;
+}
+
+/* The two ends as a Q-Expression of numbers. They're made */
+/* non-blocking, as waiting is done through the event loop */
+lval* lio_pair(char* func, int ok, int* fds) {
+  if (!ok) { return lval_err("Function '%s' failed: %s.", func, strerror(errno)); }
+  lval* x = lval_qexpr();
+  for (int i = 0; i < 2; i++) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    lval_add(x, lval_num(fds[i]));
+  }
+  return x;
+}
+
+/* Takes {}, since a call needs an argument */
+lval* builtin_pipe(lenv* e, lval* a) {
+  LASSERT_NUM("pipe", a, 1);
+  lval_del(a);
+  int fds[2];
+  return lio_pair("pipe", pipe(fds) == 0, fds);
+}
+
+/* Takes {}, since a call needs an argument */
+lval* builtin_socketpair(lenv* e, lval* a) {
+  LASSERT_NUM("socketpair", a, 1);
+  lval_del(a);
+  int fds[2];
+  return lio_pair("socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, fds);
+}
+
+/* read fd n reads up to n bytes as a Q-Expression of numbers, */
+/* giving {} at the end of the file */
+lval* builtin_read(lenv* e, lval* a) {
+  LASSERT_NUM("read", a, 2);
+  LASSERT_TYPE("read", a, 0, LVAL_NUM);
+  LASSERT_TYPE("read", a, 1, LVAL_NUM);
+  LASSERT(a, a->cell[0]->num >= 0 && a->cell[0]->num <= INT_MAX,
+    "Function 'read' passed invalid file descriptor %li.", a->cell[0]->num);
+  LASSERT(a, a->cell[1]->num > 0 && a->cell[1]->num <= INT_MAX,
+    "Function 'read' passed invalid count %li.", a->cell[1]->num);
+  
+  int fd = a->cell[0]->num;
+  long n = a->cell[1]->num;
+  unsigned char* buf = malloc(n);
+  ssize_t r;
+  while (1) {
+    if (!lio_await(fd, POLLIN)) { free(buf); return LVAL_RETRY; }
+    r = read(fd, buf, n);
+    if (r >= 0 || (errno != EAGAIN && errno != EINTR)) { break; }
+  }
+  
+  if (r < 0) {
+    lval* err = lval_err("Function 'read' failed: %s.", strerror(errno));
+    free(buf);
+    lval_del(a);
+    return err;
+  }
+  
+  lval* x = lval_qexpr();
+  lval_reserve(x, r);
+  for (ssize_t i = 0; i < r; i++) { lval_add(x, lval_num(buf[i])); }
+  free(buf);
+  lval_del(a);
+  return x;
+}
+
+/* write fd {bytes} writes as many of the bytes as it can without */
+/* waiting, at least one, and returns how many that was */
+lval* builtin_write(lenv* e, lval* a) {
+  LASSERT_NUM("write", a, 2);
+  LASSERT_TYPE("write", a, 0, LVAL_NUM);
+  LASSERT_LIST("write", a, 1);
+  LASSERT(a, a->cell[0]->num >= 0 && a->cell[0]->num <= INT_MAX,
+    "Function 'write' passed invalid file descriptor %li.", a->cell[0]->num);
+  
+  a->cell[1] = lval_flat(a->cell[1]);
+  lval* l = a->cell[1];
+  for (int i = 0; i < l->count; i++) {
+    LASSERT(a, l->cell[i]->type == LVAL_NUM
+      && l->cell[i]->num >= 0 && l->cell[i]->num <= 255,
+      "Function 'write' passed a list holding something other than bytes.");
+  }
+  /* Nothing to write; <= rather than == also bounds the malloc below */
+  if (l->count <= 0) { lval_del(a); return lval_num(0); }
+  
+  int fd = a->cell[0]->num;
+  unsigned char* buf = malloc((size_t)l->count);
+  for (int i = 0; i < l->count; i++) { buf[i] = l->cell[i]->num; }
+  ssize_t w;
+  while (1) {
+    if (!lio_await(fd, POLLOUT)) { free(buf); return LVAL_RETRY; }
+    /* A closed socket gives an error rather than SIGPIPE */
+    w = send(fd, buf, l->count, MSG_NOSIGNAL);
+    if (w < 0 && errno == ENOTSOCK) { w = write(fd, buf, l->count); }
+    if (w >= 0 || (errno != EAGAIN && errno != EINTR)) { break; }
+  }
+  
+  if (w < 0) {
+    lval* err = lval_err("Function 'write' failed: %s.", strerror(errno));
+    free(buf);
+    lval_del(a);
+    return err;
+  }
+  free(buf);
+  lval_del(a);
+  return lval_num(w);
+}
+
+/* Tasks parked on the fd are woken after, to find it closed. */
+/* Closing drops the fd from epoll, so one that parked just before */
+/* would never be woken otherwise, and one parking after can't be */
+/* watched and wakes itself */
+lval* builtin_close(lenv* e, lval* a) {
+  LASSERT_NUM("close", a, 1);
+  LASSERT_TYPE("close", a, 0, LVAL_NUM);
+  
+  int fd = a->cell[0]->num;
+  lval_del(a);
+  int r = close(fd);
+  int err = errno;
+  lio_wake(fd);
+  if (r != 0) {
+    return lval_err("Function 'close' failed: %s.", strerror(err));
+  }
+  return lval_sexpr();
+}
+
+/* Loading */
+
+lval* lread_parallel(const char* filename, const char* input,
+                     const char* stop, char** err);
+
+/* Map a file read-only for the reader to parse in place, so its */
+/* bytes are never copied and a file loaded again comes straight */
+/* from the page cache. The reader needs a NUL after the end: the */
+/* rest of the last page is zero, unless the file fills it, when a */
+/* page of zeros is mapped after it. NULL with errno set on failure */
+char* lmap_file(const char* path, size_t* len) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return NULL; }
+  struct stat st;
+  if (fstat(fd, &st) != 0) { close(fd); return NULL; }
+  
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = st.st_size;
+  *len = (size / page + 1) * page;
+  
+  char* p;
+  if (size % page) {
+    p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+  } else {
+    int zero = open("/dev/zero", O_RDONLY);
+    p = zero < 0 ? MAP_FAILED
+      : mmap(NULL, *len, PROT_READ, MAP_PRIVATE, zero, 0);
+    if (zero >= 0) { close(zero); }
+    if (p != MAP_FAILED && size
+        && mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      munmap(p, *len);
+      p = MAP_FAILED;
+    }
+  }
+  
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  if (p == MAP_FAILED) { return NULL; }
+  posix_madvise(p, *len, POSIX_MADV_SEQUENTIAL);
+  return p;
+}
+
+/* The file is named by a symbol, or a list of bytes for names */
+/* that aren't symbols. Each expression in it is evaluated in turn, */
+/* errors printed as they happen */
+lval* builtin_load(lenv* e, lval* a) {
+  LASSERT_NUM("load", a, 1);
+  LASSERT_LIST("load", a, 0);
+  LASSERT_NOT_EMPTY("load", a, 0);
+  
+  a->cell[0] = lval_flat(a->cell[0]);
+  lval* l = a->cell[0];
+  char* path;
+  if (l->count == 1 && l->cell[0]->type == LVAL_SYM) {
+    path = strdup(l->cell[0]->sym);
+  } else {
+    for (int i = 0; i < l->count; i++) {
+      LASSERT(a, l->cell[i]->type == LVAL_NUM
+        && l->cell[i]->num > 0 && l->cell[i]->num <= 255,
+        "Function 'load' passed something other than a symbol or bytes.");
+    }
+    path = malloc(l->count + 1);
+    for (int i = 0; i < l->count; i++) { path[i] = l->cell[i]->num; }
+    path[l->count] = '\0';
+  }
+  lval_del(a);
+  
+  size_t len;
+  char* input = lmap_file(path, &len);
+  if (!input) {
+    lval* err = lval_err("Could not load %s: %s.", path, strerror(errno));
+    free(path);
+    return err;
+  }
+  
+  char* msg;
+  lval* x = lread_parallel(path, input, input + len, &msg);
+  munmap(input, len);
+  free(path);
+  if (!x) {
+    lval* err = lval_err("%.*s", (int)strlen(msg) - 1, msg);
+    free(msg);
+    return err;
+  }
+  
+  /* Taken in order without lval_pop, which would make it quadratic */
+  for (int i = 0; i < x->count; i++) {
+    lval* y = lval_eval(e, x->cell[i]);
+    if (y->type == LVAL_ERR) { lval_println(y); }
+    lval_del(y);
+  }
+  x->count = 0;
+  lval_del(x);
+  return lval_sexpr();
+}
+
+/* Tasks */
+
+/* Run a spawned task until it yields or finishes. A task that */
+/* yields goes to the back of the queue, giving the others a turn */
+void ltask_slice(void* p) {
+  lfut* f = p;
+  int s = LFUT_PENDING;
+  if (!__atomic_compare_exchange_n(&f->state, &s, LFUT_RUNNING, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    lfut_release(f);
+    return;
+  }
+  
+  lfut* cur = lfut_cur;
+  lfut* top = lfut_top;
+  long fuel = lfuel, limit = lfuel_limit;
+  lfut_cur = lfut_top = f;
+  lfuel_fill(f->fuel);
+  int done = lmachine_run(f->task);
+  lfut_cur = cur;
+  lfut_top = top;
+  lfuel = fuel;
+  lfuel_limit = limit;
+  
+  /* The queue, or the event loop, takes over this job's reference */
+  if (!done) {
+    __atomic_store_n(&f->state, LFUT_PENDING, __ATOMIC_RELEASE);
+    if (f->task->fd >= 0) { lio_park(f); return; }
+    lpool_spawn(&f->job);
+    lfut_wake();
+    return;
+  }
+  
+  f->result = f->task->result;
+  f->task->result = NULL;
+  
+  pthread_mutex_lock(&lfut_lock);
+  __atomic_store_n(&f->state, LFUT_DONE, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&lfut_done);
+  pthread_mutex_unlock(&lfut_lock);
+  lio_poke();
+  lfut_release(f);
+}
+
+/* Like future, but the task runs in slices on the pool and can */
+/* yield. Any number of tasks can be waiting, they are only heap */
+lval* builtin_spawn(lenv* e, lval* a) {
+  LASSERT_NUM("spawn", a, 1);
+  LASSERT_LIST("spawn", a, 0);
+  
+  lval* x = lval_flat(lval_take(a, 0));
+  x->type = LVAL_SEXPR;
+  
+  lfut* f = lfut_new(e, ltask_slice);
+  f->task = lmachine_new(e, x);
+  lpool_spawn(&lfut_retain(f)->job);
+  return lval_fut(f);
+}
+
+/* Takes {}, since a call needs an argument. Outside a task it does */
+/* nothing */
+lval* builtin_yield(lenv* e, lval* a) {
+  LASSERT_NUM("yield", a, 1);
+  if (lmachine_cur && !lmachine_cur->resumed) { return LVAL_RETRY; }
+  lval_del(a);
+  return lval_sexpr();
+}
+
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+  lval* k = lval_sym(name);
+  lval* v = lval_fun(func);
+  lenv_put(e, k, v);
+  lval_del(k); lval_del(v);
+}
+
+void lenv_add_builtins(lenv* e) {
+  /* Variable Functions */
+  lenv_add_builtin(e, "def", builtin_def);
+  
+  /* List Functions */
+  lenv_add_builtin(e, "list", builtin_list);
+  lenv_add_builtin(e, "head", builtin_head);
+  lenv_add_builtin(e, "tail", builtin_tail);
+  lenv_add_builtin(e, "eval", builtin_eval);
+  lenv_add_builtin(e, "join", builtin_join);
+  lenv_add_builtin(e, "cons", builtin_cons);
+  lenv_add_builtin(e, "pair", builtin_pair);
+  lenv_add_builtin(e, "rope", builtin_rope);
+  
+  /* Mathematical Functions */
+  lenv_add_builtin(e, "+", builtin_add);
+  lenv_add_builtin(e, "-", builtin_sub);
+  lenv_add_builtin(e, "*", builtin_mul);
+  lenv_add_builtin(e, "/", builtin_div);
+  
+  /* Vector Functions */
+  lenv_add_builtin(e, "vec", builtin_vec);
+  lenv_add_builtin(e, "vsum", builtin_vsum);
+  lenv_add_builtin(e, "vmin", builtin_vmin);
+  lenv_add_builtin(e, "vmax", builtin_vmax);
+  lenv_add_builtin(e, "v<", builtin_vlt);
+  lenv_add_builtin(e, "v>", builtin_vgt);
+  lenv_add_builtin(e, "v=", builtin_veq);
+  
+  /* Matrix Functions */
+  lenv_add_builtin(e, "mat", builtin_mat);
+  lenv_add_builtin(e, "matmul", builtin_matmul);
+  lenv_add_builtin(e, "transpose", builtin_transpose);
+  lenv_add_builtin(e, "mslice", builtin_mslice);
+  
+  /* Parallel Functions */
+  lenv_add_builtin(e, "pmap", builtin_pmap);
+  lenv_add_builtin(e, "preduce", builtin_preduce);
+  
+  /* Futures */
+  lenv_add_builtin(e, "future", builtin_future);
+  lenv_add_builtin(e, "await", builtin_await);
+  lenv_add_builtin(e, "cancel", builtin_cancel);
+  lenv_add_builtin(e, "queued", builtin_queued);
+  
+  /* Channels */
+  lenv_add_builtin(e, "chan", builtin_chan);
+  lenv_add_builtin(e, "send", builtin_send);
+  lenv_add_builtin(e, "recv", builtin_recv);
+  lenv_add_builtin(e, "select", builtin_select);
+  
+  /* Tasks */
+  lenv_add_builtin(e, "spawn", builtin_spawn);
+  lenv_add_builtin(e, "yield", builtin_yield);
+  
+  /* I/O Functions */
+  lenv_add_builtin(e, "pipe", builtin_pipe);
+  lenv_add_builtin(e, "socketpair", builtin_socketpair);
+  lenv_add_builtin(e, "read", builtin_read);
+  lenv_add_builtin(e, "write", builtin_write);
+  lenv_add_builtin(e, "close", builtin_close);
+  lenv_add_builtin(e, "load", builtin_load);
+}
+
+/* Parallel Arguments */
+
+/* Set by --parallel-args */
+int lpar_enabled = 0;
+
+/* S-Expression arguments with at least this many S-Expression nodes */
+/* are evaluated as jobs, smaller ones aren't worth the hand off */
+#define LPAR_GRAIN 64
+
+/* Builtins whose results depend on the order arguments are */
+/* evaluated in. eval counts as it can run anything, and the ones */
+/* making fds, channels and tasks do as which comes first shows */
+lbuiltin lpar_impure[] = { builtin_def, builtin_eval, builtin_cancel,
+  builtin_chan, builtin_send, builtin_recv, builtin_select, builtin_spawn,
+  builtin_yield, builtin_pipe, builtin_socketpair, builtin_read,
+  builtin_write, builtin_close, builtin_load, NULL };
+
+/* Set while evaluating an argument already checked to be pure */
+__thread int lpar_in_pure = 0;
+
+/* Count S-Expression nodes, stopping once limit is reached */
+int lpar_weight(lval* v, int limit) {
+  if (v->type != LVAL_SEXPR) { return 0; }
+  int w = 1;
+  for (int i = 0; i < v->count && w < limit; i++) {
+    w += lpar_weight(v->cell[i], limit - w);
+  }
+  return w;
+}
+
+/* Look for the first impure symbol in v, at depth d below the walk's */
+/* start, filling path with the cell taken at each depth on the way */
+/* to it. Symbols in Q-Expressions are only called through eval, */
+/* which is impure itself, so only S-Expressions need looking into */
+int lpar_impure_at(lenv* e, lval* v, int d, int** path) {
+  if (v->type == LVAL_SYM) {
+    lbuiltin f = lenv_get_fun(e, v->sym);
+    for (int i = 0; f && lpar_impure[i]; i++) {
+      if (f == lpar_impure[i]) { *path = malloc(sizeof(int) * d); return 1; }
+    }
+    return 0;
+  }
+  if (v->type != LVAL_SEXPR) { return 0; }
+  for (int i = 0; i < v->count; i++) {
+    if (lpar_impure_at(e, v->cell[i], d+1, path)) { (*path)[d] = i; return 1; }
+  }
+  return 0;
+}
+
+/* Pass on what the walk behind frame f learnt about the cell it is */
+/* entering as frame c. Cells before the path were walked and are */
+/* pure, the one on it is impure, and those after it weren't reached. */
+/* So each cell is walked at most once however deeply it is nested */
+void lpar_inherit(lframe* f, lframe* c) {
+  if (f->pure == 1) { c->pure = 1; return; }
+  if (f->pure == 0) {
+    int j = f->path[f->at];
+    if (f->i < j) { c->pure = 1; }
+    if (f->i == j) { c->pure = 0; c->path = f->path; c->at = f->at + 1; }
+  }
+}
+
+typedef struct larg {
+  lenv* e;
+  lval** cell;
+  lfut* fut; /* future the argument belongs to, if any */
+} larg;
+
+void larg_eval(void* p) {
+  larg* a = p;
+  int in_pure = lpar_in_pure;
+  lfut* cur = lfut_cur;
+  lpar_in_pure = 1;
+  lfut_cur = a->fut;
+  *a->cell = lval_eval(a->e, *a->cell);
+  lpar_in_pure = in_pure;
+  lfut_cur = cur;
+}
+
+/* Evaluate the cells of v with the heavy ones as pool jobs. Returns */
+/* 0 without evaluating anything when it isn't worth it or order */
+/* might matter. Errors are left in place as serial evaluation does */
+int lval_eval_par(lenv* e, lframe* f) {
+  if (lpool_size() == 1) { return 0; }
+  
+  lval* v = f->v;
+  int heavy = 0;
+  for (int i = 0; i < v->count; i++) {
+    heavy += lpar_weight(v->cell[i], LPAR_GRAIN) >= LPAR_GRAIN;
+  }
+  if (heavy < 2) { return 0; }
+  if (!lpar_in_pure && f->pure < 0) {
+    f->pure = !lpar_impure_at(e, v, 0, &f->path);
+  }
+  if (!lpar_in_pure && !f->pure) { return 0; }
+  
+  int in_pure = lpar_in_pure;
+  lpar_in_pure = 1;
+  
+  ljob* jobs = malloc(sizeof(ljob) * heavy);
+  larg* args = malloc(sizeof(larg) * heavy);
+  int n = 0;
+  for (int i = 0; i < v->count; i++) {
+    if (lpar_weight(v->cell[i], LPAR_GRAIN) < LPAR_GRAIN) {
+      v->cell[i] = lval_eval(e, v->cell[i]);
+      continue;
+    }
+    args[n].e = e;
+    args[n].cell = &v->cell[i];
+    args[n].fut = lfut_cur;
+    jobs[n].run = larg_eval;
+    jobs[n].arg = &args[n];
+    n++;
+  }
+  lpool_run(jobs, n);
+  
+  lpar_in_pure = in_pure;
+  free(jobs);
+  free(args);
+  return 1;
+}
+
+/* Evaluation */
+
+void lmachine_push(lmachine* m, lframe* f) {
+  if (m->depth == m->cap) {
+    lframe* frames = malloc(sizeof(lframe) * m->cap * 2);
+    memcpy(frames, m->frames, sizeof(lframe) * m->depth);
+    if (m->heap) { free(m->frames); }
+    m->frames = frames;
+    m->cap *= 2;
+    m->heap = 1;
+  }
+  m->frames[m->depth++] = *f;
+}
+
+/* Hand a finished value to the frame waiting on it */
+void lmachine_return(lmachine* m, lval* r) {
+  if (m->depth == 0) { m->result = r; return; }
+  lframe* f = &m->frames[m->depth-1];
+  f->v->cell[f->i++] = r;
+}
+
+/* Start evaluating S-Expression v in a new frame, as a cell of the */
+/* top frame if child is set */
+void lmachine_enter(lmachine* m, lval* v, int child) {
+  
+  /* A cancelled future stops at its next call */
+  if (lfut_cur && __atomic_load_n(&lfut_cur->cancel, __ATOMIC_RELAXED)) {
+    lval_del(v);
+    lmachine_return(m, lval_err("Future was cancelled."));
+    return;
+  }
+  
+  /* Cells are evaluated in place, so they mustn't be shared */
+  lval_own(v);
+  
+  lframe f = { v, 0, NULL, -1, 0, NULL };
+  if (child) { lpar_inherit(&m->frames[m->depth-1], &f); }
+  
+  /* Cells already evaluated in parallel go straight to the call */
+  if (lpar_enabled && lval_eval_par(m->e, &f)) { f.i = v->count; }
+  lmachine_push(m, &f);
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* Call the function in front of a fully evaluated frame. Returns */
+/* NULL when the call continues in a new frame, as eval does */
+lval* lmachine_apply(lmachine* m, lframe* f) {
+  lval* v = f->v;
   
-  for (int i = 0; i < a->count; i++) {
-    LASSERT_TYPE(op, a, i, LVAL_NUM);
+  if (!f->fn) {
+    for (int i = 0; i < v->count; i++) {
+      if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    }
+    
+    if (v->count == 0) { return v; }
+    if (v->count == 1) { return lval_take(v, 0); }
+    
+    /* Ensure first element is a function after evaluation */
+    f->fn = lval_pop(v, 0);
+    if (f->fn->type != LVAL_FUN) {
+      lval* err = lval_err(
+        "S-Expression starts with incorrect type. "
+        "Got %s, Expected %s.",
+        ltype_name(f->fn->type), ltype_name(LVAL_FUN));
+      lval_del(f->fn); lval_del(v);
+      return err;
+    }
   }
   
-  lval* x = lval_pop(a, 0);
-  
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    x->num = -x->num;
+  /* eval carries on in this machine, so tasks can yield inside it */
+  if (f->fn->fun == builtin_eval) {
+    lval_del(f->fn);
+    lval* x = builtin_eval_expr(v);
+    if (x->type == LVAL_ERR) { return x; }
+    lmachine_enter(m, x, 0);
+    return NULL;
   }
   
-  while (a->count > 0) {  
-    lval* y = lval_pop(a, 0);
+  lmachine* cur = lmachine_cur;
+  lmachine_cur = m->task ? m : NULL;
+  lval* result = f->fn->fun(m->e, v);
+  lmachine_cur = cur;
+  
+  if (result == LVAL_RETRY) { return result; }
+  m->resumed = 0;
+  lval_del(f->fn);
+  return result;
+}
+
+/* Drop every frame of m, top first. Each frame below the top still */
+/* has the cell its child is working on, which the child now owns */
+void lmachine_unwind(lmachine* m) {
+  for (int d = m->depth-1; d >= 0; d--) {
+    lframe* f = &m->frames[d];
+    if (d < m->depth-1) { f->v->cell[f->i] = lval_sexpr(); }
+    if (f->fn) { lval_del(f->fn); }
+    if (f->path && !f->at) { free(f->path); }
+    lval_del(f->v);
+  }
+  m->depth = 0;
+}
+
+/* Called between steps once lfuel runs out. A task stops to let */
+/* the others run, and gets fresh fuel next slice. Evaluation inside */
+/* a task's call can't stop part way, so it's left to finish and the */
+/* task stops after. Anything else is abandoned with an error */
+int lmachine_out_of_fuel(lmachine* m) {
+  if (m->task) { return 1; }
+  if (lfut_cur && lfut_cur->task) { return 0; }
+  lmachine_unwind(m);
+  m->result = lval_err("Evaluation ran out of fuel.");
+  return 1;
+}
+
+/* Step m until it finishes, returning 1, or until a call in a task */
+/* asks to be retried or the task runs out of fuel, returning 0 */
+/* with its frames left as they are */
+int lmachine_run(lmachine* m) {
+  while (m->depth) {
+    if (--lfuel < 0 && lmachine_out_of_fuel(m)) { return !m->task; }
     
-    if (strcmp(op, "+") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x); lval_del(y);
-        x = lval_err("Division By Zero.");
-        break;
+    lframe* f = &m->frames[m->depth-1];
+    
+    if (!f->fn && f->i < f->v->count) {
+      lval* c = f->v->cell[f->i];
+      if (c->type == LVAL_SEXPR) { lmachine_enter(m, c, 1); continue; }
+      if (c->type == LVAL_SYM) {
+        f->v->cell[f->i] = lenv_get(m->e, c);
+        lval_del(c);
       }
-      x->num /= y->num;
+      f->i++;
+      continue;
     }
     
-    lval_del(y);
+    lframe top = *f;
+    m->depth--;
+    lval* r = lmachine_apply(m, &top);
+    if (r == LVAL_RETRY) {
+      m->frames[m->depth++] = top;
+      m->resumed = 1;
+      return 0;
+    }
+    if (top.path && !top.at) { free(top.path); }
+    if (r) { lmachine_return(m, r); }
+  }
+  return 1;
+}
+
+/* A machine for a task, which keeps its frames between slices */
+lmachine* lmachine_new(lenv* e, lval* v) {
+  lmachine* m = malloc(sizeof(lmachine));
+  m->e = e;
+  m->task = 1;
+  m->resumed = 0;
+  m->heap = 1;
+  m->depth = 0;
+  m->cap = 4;
+  m->frames = malloc(sizeof(lframe) * m->cap);
+  m->result = NULL;
+  m->fd = -1;
+  lmachine_enter(m, v, 0);
+  return m;
+}
+
+/* Free a machine stopped part way */
+void lmachine_free(lmachine* m) {
+  lmachine_unwind(m);
+  if (m->result) { lval_del(m->result); }
+  free(m->frames);
+  free(m);
+}
+
+/* Frames lval_eval keeps on the C stack before going to the heap */
+#define LMACHINE_FRAMES 16
+
+lval* lval_eval(lenv* e, lval* v) {
+  if (v->type == LVAL_SYM) {
+    lval* x = lenv_get(e, v);
+    lval_del(v);
+    return x;
   }
+  if (v->type != LVAL_SEXPR) { return v; }
   
-  lval_del(a);
-  return x;
+  lframe frames[LMACHINE_FRAMES];
+  lmachine m = { e, 0, 0, 0, 0, LMACHINE_FRAMES, frames, NULL, -1, 0 };
+  lmachine_enter(&m, v, 0);
+  lmachine_run(&m);
+  if (m.heap) { free(m.frames); }
+  return m.result;
 }
 
-lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+/* Reading */
+
+/* Lines are read by hand in one pass straight from the input, so */
+/* tokens are never copied out before becoming lvals. The grammar */
+/* is the one under Isolates, which --reader=mpc still uses */
+
+/* Set by --reader=mpc */
+int lread_mpc = 0;
+
+/* Each character's class is looked up once and switched on, rather */
+/* than found by comparing it with each kind of token in turn */
+enum { LREAD_OTHER, LREAD_SPACE, LREAD_OPEN, LREAD_CLOSE,
+       LREAD_SIGN, LREAD_DIGIT, LREAD_SYMBOL };
+
+unsigned char lread_class[256];
+#define LREAD_CLASS(c) lread_class[(unsigned char)(c)]
+
+/* Where the input is only being cut up, at spaces and brackets, it */
+/* is classified 64 bytes at a time into a bitmask per class, bit i */
+/* for byte i, and the masks are worked on instead of the bytes */
+typedef struct lmask {
+  uint64_t open, close, space, line, nul;
+} lmask;
+
+/* Without SIMD, 8 bytes at a time in a word. Each byte equal to c */
+/* gets its top bit set, exactly: a byte t is zero iff neither its */
+/* top bit nor the carry out of its low 7 bits plus 0x7f is set */
+uint64_t lmask_eq8(uint64_t x, unsigned char c) {
+  uint64_t lo = 0x7f7f7f7f7f7f7f7full;
+  uint64_t t = x ^ (0x0101010101010101ull * c);
+  return ~(((t & lo) + lo) | t | lo);
 }
 
-lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
+/* Gather the top bit of each byte into bits 0 to 7 */
+#define LMASK_PACK(h) ((((h) >> 7) * 0x0102040810204080ull) >> 56)
+
+void lmask_block(const char* s, lmask* m) {
+  uint64_t open = 0, close = 0, spaces = 0, lines = 0, nul = 0;
+  for (int i = 0; i < 64; i += 8) {
+    uint64_t x;
+    memcpy(&x, s + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    uint64_t line = lmask_eq8(x, '\n');
+    uint64_t space = lmask_eq8(x, ' ') | lmask_eq8(x, '\t') | line
+      | lmask_eq8(x, '\v') | lmask_eq8(x, '\f') | lmask_eq8(x, '\r');
+    open |= LMASK_PACK(lmask_eq8(x, '(') | lmask_eq8(x, '{')) << i;
+    close |= LMASK_PACK(lmask_eq8(x, ')') | lmask_eq8(x, '}')) << i;
+    spaces |= LMASK_PACK(space) << i;
+    lines |= LMASK_PACK(line) << i;
+    nul |= LMASK_PACK(lmask_eq8(x, '\0')) << i;
+  }
+  m->open = open;
+  m->close = close;
+  m->space = spaces;
+  m->line = lines;
+  m->nul = nul;
 }
 
-lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
+#ifdef LVEC_AVX2
+#define LMASK_EQ(x, c) \
+  (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(c)))
+
+LVEC_AVX2 void lmask_block_avx2(const char* s, lmask* m) {
+  memset(m, 0, sizeof(lmask));
+  for (int h = 0; h < 64; h += 32) {
+    __m256i x = _mm256_loadu_si256((__m256i*)(s + h));
+    
+    /* \t to \r are 9 to 13, the only bytes with x-9 at most 4 */
+    __m256i c = _mm256_sub_epi8(x, _mm256_set1_epi8(9));
+    uint32_t ctl = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_min_epu8(c, _mm256_set1_epi8(4)), c));
+    
+    m->open |= (uint64_t)(LMASK_EQ(x, '(') | LMASK_EQ(x, '{')) << h;
+    m->close |= (uint64_t)(LMASK_EQ(x, ')') | LMASK_EQ(x, '}')) << h;
+    m->space |= (uint64_t)(LMASK_EQ(x, ' ') | ctl) << h;
+    m->line |= (uint64_t)LMASK_EQ(x, '\n') << h;
+    m->nul |= (uint64_t)LMASK_EQ(x, '\0') << h;
+  }
 }
+#endif
 
-lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
+/* Scalar until lread_init finds AVX2 */
+void (*lmask_kernel)(const char* s, lmask* m) = lmask_block;
+
+/* The masks for the 64 bytes at s, of which n are there to read. */
+/* Past the end they are as if for NULs */
+void lmask_at(const char* s, long n, lmask* m) {
+  if (n >= 64) { lmask_kernel(s, m); return; }
+  char pad[64] = {0};
+  memcpy(pad, s, n);
+  lmask_kernel(pad, m);
 }
 
-lval* builtin_def(lenv* e, lval* a) {
+/* Bits 0 to i */
+#define LMASK_UPTO(i) ((i) >= 63 ? ~(uint64_t)0 : ((uint64_t)2 << (i)) - 1)
 
-  LASSERT_TYPE("def", a, 0, LVAL_QEXPR);
+/* Where the first byte of s[0..n) that isn't a space is, or n */
+long lmask_skip_space(const char* s, long n) {
+  for (long i = 0; i < n; i += 64) {
+    lmask m;
+    lmask_at(s + i, n - i, &m);
+    if (~m.space) {
+      long j = i + __builtin_ctzll(~m.space);
+      return j < n ? j : n;
+    }
+  }
+  return n;
+}
+
+/* Where the first space or bracket in s[0..n) is, or n */
+long lmask_atom_end(const char* s, long n) {
+  for (long i = 0; i < n; i += 64) {
+    lmask m;
+    lmask_at(s + i, n - i, &m);
+    uint64_t x = m.space | m.open | m.close;
+    if (x) {
+      long j = i + __builtin_ctzll(x);
+      return j < n ? j : n;
+    }
+  }
+  return n;
+}
+
+/* Just past the bracket in s[0..n) that brings depth to 0, or n */
+/* with depth counted to the end */
+long lmask_list_end(const char* s, long n, int* depth) {
+  for (long i = 0; i < n; i += 64) {
+    lmask m;
+    lmask_at(s + i, n - i, &m);
+    for (uint64_t b = m.open | m.close; b; b &= b - 1) {
+      int j = __builtin_ctzll(b);
+      if (m.open >> j & 1) { ++*depth; }
+      else if (--*depth == 0) { return i + j + 1; }
+    }
+  }
+  return n;
+}
+
+void lread_init(void) {
+  for (char* c = " \t\n\r\f\v"; *c; c++) { LREAD_CLASS(*c) = LREAD_SPACE; }
+  for (char* c = "_+*/\\=<>!&"; *c; c++) { LREAD_CLASS(*c) = LREAD_SYMBOL; }
+  for (int c = 'a'; c <= 'z'; c++) { lread_class[c] = LREAD_SYMBOL; }
+  for (int c = 'A'; c <= 'Z'; c++) { lread_class[c] = LREAD_SYMBOL; }
+  for (int c = '0'; c <= '9'; c++) { lread_class[c] = LREAD_DIGIT; }
+  LREAD_CLASS('-') = LREAD_SIGN;
+  LREAD_CLASS('(') = LREAD_CLASS('{') = LREAD_OPEN;
+  LREAD_CLASS(')') = LREAD_CLASS('}') = LREAD_CLOSE;
   
-  /* First argument is symbol list */
-  lval* syms = a->cell[0];
+#ifdef LVEC_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) { lmask_kernel = lmask_block_avx2; }
+#endif
+}
+
+int lread_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+int lread_symbol(char c) {
+  return LREAD_CLASS(c) >= LREAD_SIGN;
+}
+
+/* The value of the 8 digits at s. As a little-endian word each */
+/* digit is a byte, and three multiplies combine neighbours into */
+/* pairs, pairs into fours and fours into the eight */
+uint64_t lread_digits8(const char* s) {
+  uint64_t v;
+  memcpy(&v, s, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  v = (v & 0x0f0f0f0f0f0f0f0full) * (10 * 256 + 1) >> 8;
+  v = (v & 0x00ff00ff00ff00ffull) * (100 * 65536 + 1) >> 16;
+  return (v & 0x0000ffff0000ffffull) * (10000 * 4294967296ull + 1) >> 32;
+}
+
+/* Read the integer /-?[0-9]+/ from s to end into x, or return 0 if */
+/* it's out of range for a long. Past leading zeros, 19 digits */
+/* always fit in 64 bits unsigned, and 20 never fit in a long */
+int lread_long(const char* s, const char* end, long* x) {
+  int neg = *s == '-';
+  s += neg;
+  while (end - s > 1 && *s == '0') { s++; }
+  if (end - s > 19) { return 0; }
   
-  /* Ensure all elements of first list are symbols */
-  for (int i = 0; i < syms->count; i++) {
-    LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
-      "Function 'def' cannot define non-symbol. "
-      "Got %s, Expected %s.",
-      ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
-  }
+  uint64_t u = 0;
+  for (; end - s >= 8; s += 8) { u = u * 100000000 + lread_digits8(s); }
+  for (; s < end; s++) { u = u * 10 + (*s - '0'); }
   
-  /* Check correct number of symbols and values */
-  LASSERT(a, (syms->count == a->count-1),
-    "Function 'def' passed too many arguments for symbols. "
-    "Got %i, Expected %i.",
-    syms->count, a->count-1);
+  if (u > (uint64_t)LONG_MAX + neg) { return 0; }
+  *x = !neg ? (long)u : u ? -(long)(u - 1) - 1 : 0;
+  return 1;
+}
+
+lval* lval_read_num(char* s) {
+  if (strpbrk(s, ".eE")) {
+    return lval_dbl(strtod(s, NULL));
+  }
   
-  /* Assign copies of values to symbols */
-  for (int i = 0; i < syms->count; i++) {
-    lenv_put(e, syms->cell[i], a->cell[i+1]);
+  /* Literals too big for a long are read as bignums instead */
+  long x;
+  return lread_long(s, s + strlen(s), &x) ? lval_num(x) : lval_big(lbig_read(s));
+}
+
+/* Where number /-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?/ starting */
+/* at s ends, or s if there's none */
+const char* lread_number_end(const char* s) {
+  const char* p = s + (*s == '-');
+  if (!lread_digit(*p)) { return s; }
+  while (lread_digit(*p)) { p++; }
+  if (p[0] == '.' && lread_digit(p[1])) {
+    for (p += 2; lread_digit(*p); p++) {}
+  }
+  if (*p == 'e' || *p == 'E') {
+    const char* q = p + 1;
+    if (*q == '-' || *q == '+') { q++; }
+    if (lread_digit(*q)) {
+      for (p = q; lread_digit(*p); p++) {}
+    }
+  }
+  return p;
+}
+
+/* Plain integers are read where they are. Only doubles and */
+/* bignums need the token copied out */
+lval* lread_number(const char* s, const char* end) {
+  int n = end - s;
+  int plain = 1;
+  for (const char* p = s; p < end; p++) {
+    if (*p == '.' || *p == 'e' || *p == 'E') { plain = 0; }
   }
+  long x;
+  if (plain && lread_long(s, end, &x)) { return lval_num(x); }
   
-  lval_del(a);
-  return lval_sexpr();
+  char small[64];
+  char* t = n < 64 ? small : malloc(n + 1);
+  memcpy(t, s, n);
+  t[n] = '\0';
+  lval* v = plain ? lval_big(lbig_read(t)) : lval_read_num(t);
+  if (t != small) { free(t); }
+  return v;
 }
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
-  lval* k = lval_sym(name);
-  lval* v = lval_fun(func);
-  lenv_put(e, k, v);
-  lval_del(k); lval_del(v);
+/* Report the item starting at s the way mpc would, as one that */
+/* isn't an expression: expr* stops before it and /$/ fails there. */
+/* input starts at the given row and column of the file */
+char* lread_error(const char* filename, const char* input, const char* s,
+                  int row, int col) {
+  for (const char* p = input; p < s; p++) {
+    if (*p == '\n') { row++; col = 0; } else { col++; }
+  }
+  
+  /* Whitespace and the end are never the start of an item */
+  char c[4] = { '\'', *s, '\'', '\0' };
+  char* at = *s == '\a' ? "bell" : *s == '\b' ? "backspace" : c;
+  
+  int n = snprintf(NULL, 0, "%s:%i:%i: error: expected end of input at %s\n",
+    filename, row+1, col+1, at);
+  char* err = malloc(n + 1);
+  snprintf(err, n + 1, "%s:%i:%i: error: expected end of input at %s\n",
+    filename, row+1, col+1, at);
+  return err;
 }
 
-void lenv_add_builtins(lenv* e) {
-  /* Variable Functions */
-  lenv_add_builtin(e, "def", builtin_def);
+/* Read every expression in input, up to stop or a NUL, into one */
+/* S-Expression, or return NULL with the error in *err. Lists still */
+/* open are kept on a stack rather than by recursion, so nesting */
+/* depth is unlimited */
+lval* lread(const char* filename, const char* input, const char* stop,
+            int row, int col, char** err) {
+  int depth = 0, cap = 16;
+  lval** open = malloc(sizeof(lval*) * cap);
+  open[0] = lval_sexpr();
   
-  /* List Functions */
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "join", builtin_join);
+  const char* s = input;
+  const char* item = s; /* start of the current top-level item */
+  while (1) {
+    while (s < stop && LREAD_CLASS(*s) == LREAD_SPACE) { s++; }
+    if (depth == 0) { item = s; }
+    char c = s < stop ? *s : '\0';
+    
+    if (c == '\0' && depth == 0) { break; }
+    
+    const char* end;
+    switch (LREAD_CLASS(c)) {
+      case LREAD_OPEN:
+        if (++depth == cap) {
+          cap *= 2;
+          open = realloc(open, sizeof(lval*) * cap);
+        }
+        open[depth] = c == '(' ? lval_sexpr() : lval_qexpr();
+        s++;
+        continue;
+      
+      case LREAD_CLOSE:
+        if (depth && open[depth]->type == (c == ')' ? LVAL_SEXPR : LVAL_QEXPR)) {
+          lval* x = open[depth--];
+          lval_add(open[depth], x);
+          s++;
+          continue;
+        }
+        break;
+      
+      case LREAD_SIGN:
+      case LREAD_DIGIT:
+        end = lread_number_end(s);
+        if (end != s) {
+          lval_add(open[depth], lread_number(s, end));
+          s = end;
+          continue;
+        }
+        /* A sign with no digits after it starts a symbol */
+        /* fall through */
+      
+      case LREAD_SYMBOL:
+        for (end = s+1; lread_symbol(*end); end++) {}
+        lval_add(open[depth], lval_sym_len(s, end - s));
+        s = end;
+        continue;
+    }
+    
+    /* Anything else, an unclosed list included, fails the whole */
+    /* item it's in */
+    for (int d = depth; d >= 0; d--) { lval_del(open[d]); }
+    free(open);
+    *err = lread_error(filename, input, item, row, col);
+    return NULL;
+  }
   
-  /* Mathematical Functions */
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
+  lval* x = open[0];
+  free(open);
+  return x;
 }
 
-/* Evaluation */
+/* Input bigger than this is split at top-level items and the */
+/* pieces read on the pool */
+#define LREAD_SPLIT (1 << 20)
+
+typedef struct lpiece {
+  const char* filename;
+  const char* from;
+  const char* to;
+  int row, col; /* where from is in the input */
+  lval* x;
+  char* err;
+} lpiece;
+
+void lpiece_read(void* arg) {
+  lpiece* p = arg;
+  p->x = lread(p->filename, p->from, p->to, p->row, p->col, &p->err);
+}
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+/* Read input as lread would, in parallel. One pass over the masks */
+/* counts brackets and lines to find spaces outside any list, where */
+/* the input can be cut, and each piece is read into its own list. */
+/* Depth isn't kept from going below 0, so after a stray close */
+/* bracket nothing more is cut: that piece fails anyway. The lists are */
+/* joined in order, and the first piece that fails gives the error */
+/* lread would: every piece before it read just as it would have */
+lval* lread_parallel(const char* filename, const char* input,
+                     const char* stop, char** err) {
+  long len = stop - input;
+  if (len < LREAD_SPLIT || lpool_size() == 1) {
+    return lread(filename, input, stop, 0, 0, err);
+  }
   
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
+  long size = len / (lpool_size() * 4);
+  if (size < LREAD_SPLIT / 4) { size = LREAD_SPLIT / 4; }
+  
+  int n = 0, cap = 16, depth = 0, rows = 0;
+  lpiece* ps = malloc(sizeof(lpiece) * cap);
+  ps[0].from = input;
+  ps[0].row = ps[0].col = 0;
+  const char* line = input; /* just after the last newline */
+  const char* s;
+  for (s = input; s < stop; s += 64) {
+    lmask m;
+    lmask_at(s, stop - s, &m);
+    
+    /* Only up to a NUL, which ends the input */
+    uint64_t live = m.nul ? (m.nul & -m.nul) - 1 : ~(uint64_t)0;
+    uint64_t brackets = (m.open | m.close) & live;
+    
+    /* Until a piece is big enough only depth matters, and it's */
+    /* counted a block at a time. After that it's followed from one */
+    /* bracket to the next, depth not changing in between */
+    int lo = 0;
+    while (lo < 64) {
+      long min = ps[n].from + size - 1 - s;
+      if (min >= 64) { break; }
+      
+      int hi = brackets ? __builtin_ctzll(brackets) : 64;
+      uint64_t spaces = m.space & live & ~(LMASK_UPTO(lo) >> 1)
+        & (hi == 64 ? ~(uint64_t)0 : LMASK_UPTO(hi) >> 1);
+      if (depth == 0) {
+        if (min > 0) { spaces &= ~(LMASK_UPTO(min) >> 1); }
+        if (spaces) {
+          int i = __builtin_ctzll(spaces);
+          uint64_t lines = m.line & LMASK_UPTO(i);
+          ps[n++].to = s+i+1;
+          if (n == cap) {
+            cap *= 2;
+            ps = realloc(ps, sizeof(lpiece) * cap);
+          }
+          ps[n].from = s+i+1;
+          ps[n].row = rows + __builtin_popcountll(lines);
+          ps[n].col = s+i+1 - (lines ? s + 64 - __builtin_clzll(lines) : line);
+          lo = i+1;
+          continue;
+        }
+      }
+      
+      if (hi == 64) { break; }
+      depth += m.open >> hi & 1 ? 1 : -1;
+      brackets &= brackets - 1;
+      lo = hi+1;
+    }
+    depth += __builtin_popcountll(m.open & brackets)
+      - __builtin_popcountll(m.close & brackets);
+    
+    uint64_t lines = m.line & live;
+    rows += __builtin_popcountll(lines);
+    if (lines) { line = s + 64 - __builtin_clzll(lines); }
+    if (m.nul) {
+      s += __builtin_ctzll(m.nul);
+      break;
+    }
   }
+  if (s > stop) { s = stop; }
+  ps[n++].to = s;
   
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+  ljob* jobs = malloc(sizeof(ljob) * n);
+  for (int i = 0; i < n; i++) {
+    ps[i].filename = filename;
+    jobs[i].run = lpiece_read;
+    jobs[i].arg = &ps[i];
   }
+  lpool_run(jobs, n);
+  free(jobs);
+  
+  lval* x = lval_sexpr();
+  *err = NULL;
+  for (int i = 0; i < n; i++) {
+    if (!ps[i].x) {
+      if (!*err) { *err = ps[i].err; } else { free(ps[i].err); }
+    } else if (*err) {
+      lval_del(ps[i].x);
+    } else {
+      x = lval_join(x, ps[i].x);
+    }
+  }
+  free(ps);
+  if (*err) { lval_del(x); return NULL; }
+  return x;
+}
+
+/* Callbacks for the mpc grammar. They build lvals as mpc goes, so */
+/* a line is never held as an mpc_ast_t tree as well */
+
+mpc_val_t* lread_num(mpc_val_t* s) {
+  lval* x = lval_read_num(s);
+  free(s);
+  return x;
+}
+
+mpc_val_t* lread_sym(mpc_val_t* s) {
+  lval* x = lval_sym(s);
+  free(s);
+  return x;
+}
+
+/* mpc hands over every item of a list at once, so the cells are */
+/* allocated in one go */
+mpc_val_t* lread_sexpr(int n, mpc_val_t** xs) {
+  return lval_add_many(lval_sexpr(), (lval**)xs, n);
+}
+
+mpc_val_t* lread_qexpr(mpc_val_t* x) {
+  ((lval*)x)->type = LVAL_QEXPR;
+  return x;
+}
+
+/* Keep the list between a pair of brackets or anchors */
+mpc_val_t* lread_inner(int n, mpc_val_t** xs) {
+  free(xs[0]);
+  free(xs[2]);
+  return xs[1];
+}
+
+void lread_del(mpc_val_t* x) {
+  lval_del(x);
+}
+
+/* Isolates */
+
+/* The grammar never changes once built, so every isolate shares it */
+mpc_parser_t* Number;
+mpc_parser_t* Symbol;
+mpc_parser_t* Sexpr;
+mpc_parser_t* Qexpr;
+mpc_parser_t* Expr;
+mpc_parser_t* Lispy;
+
+pthread_once_t jlisp_once = PTHREAD_ONCE_INIT;
+
+/* mpc formats parse errors in a static buffer */
+pthread_mutex_t jlisp_err_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void jlisp_init(void) {
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  Sexpr  = mpc_new("sexpr");
+  Qexpr  = mpc_new("qexpr");
+  Expr   = mpc_new("expr");
+  Lispy  = mpc_new("lispy");
   
-  if (v->count == 0) { return v; }  
-  if (v->count == 1) { return lval_take(v, 0); }
+  /* The Lispy grammar, wired up by hand so the callbacks can build */
+  /* lvals directly: */
+  /*   number : /-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; */
+  /*   symbol : /[a-zA-Z0-9_+\-*\/\\=<>!&]+/ ; */
+  /*   sexpr  : '(' <expr>* ')' ; */
+  /*   qexpr  : '{' <expr>* '}' ; */
+  /*   expr   : <number> | <symbol> | <sexpr> | <qexpr> ; */
+  /*   lispy  : /^/ <expr>* /$/ ; */
+  mpc_define(Number, mpc_apply(
+    mpc_tok(mpc_re("-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?")), lread_num));
+  mpc_define(Symbol, mpc_apply(
+    mpc_tok(mpc_re("[a-zA-Z0-9_+\\-*/\\\\=<>!&]+")), lread_sym));
+  mpc_define(Sexpr, mpc_and(3, lread_inner,
+    mpc_sym("("), mpc_many(lread_sexpr, Expr), mpc_sym(")"),
+    free, lread_del));
+  mpc_define(Qexpr, mpc_apply(mpc_and(3, lread_inner,
+    mpc_sym("{"), mpc_many(lread_sexpr, Expr), mpc_sym("}"),
+    free, lread_del), lread_qexpr));
+  mpc_define(Expr, mpc_or(4, Number, Symbol, Sexpr, Qexpr));
+  mpc_define(Lispy, mpc_and(3, lread_inner,
+    mpc_tok(mpc_re("^")), mpc_many(lread_sexpr, Expr), mpc_tok(mpc_re("$")),
+    free, lread_del));
   
-  /* Ensure first element is a function after evaluation */
-  lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
-    lval* err = lval_err(
-      "S-Expression starts with incorrect type. "
-      "Got %s, Expected %s.",
-      ltype_name(f->type), ltype_name(LVAL_FUN));
-    lval_del(f); lval_del(v);
-    return err;
+  lread_init();
+  lvec_init();
+  lmat_init();
+  ldbl_init();
+}
+
+struct jlisp_isolate {
+  lenv* env;
+  long fuel;
+};
+
+jlisp_isolate* jlisp_isolate_new(void) {
+  pthread_once(&jlisp_once, jlisp_init);
+  
+  jlisp_isolate* iso = malloc(sizeof(jlisp_isolate));
+  iso->env = lenv_new();
+  iso->fuel = 0;
+  lenv_add_builtins(iso->env);
+  return iso;
+}
+
+void jlisp_set_fuel(jlisp_isolate* iso, long fuel) {
+  iso->fuel = fuel > 0 ? fuel : 0;
+}
+
+void jlisp_isolate_del(jlisp_isolate* iso) {
+  /* Futures still running hold their own reference to the */
+  /* environment, and it goes once the last of them finishes */
+  lenv_clear(iso->env);
+  lenv_release(iso->env);
+  free(iso);
+}
+
+/* Read input with the reader in use, see lread */
+lval* jlisp_read(const char* filename, const char* input, char** err) {
+  if (!lread_mpc) {
+    return lread_parallel(filename, input, input + strlen(input), err);
   }
   
-  /* If so call function to get result */
-  lval* result = f->fun(e, v);
-  lval_del(f);
-  return result;
+  mpc_result_t r;
+  if (mpc_parse(filename, input, Lispy, &r)) { return r.output; }
+  pthread_mutex_lock(&jlisp_err_lock);
+  *err = mpc_err_string(r.error);
+  pthread_mutex_unlock(&jlisp_err_lock);
+  mpc_err_delete(r.error);
+  return NULL;
 }
 
-lval* lval_eval(lenv* e, lval* v) {
-  if (v->type == LVAL_SYM) {
-    lval* x = lenv_get(e, v);
-    lval_del(v);
-    return x;
+/* Evaluate x and print the result to out, or if x is NULL print */
+/* err, why it couldn't be read */
+int jlisp_eval_read(jlisp_isolate* iso, lval* x, char* err, FILE* out) {
+  
+  FILE* prev = lval_out;
+  long fuel = lfuel, limit = lfuel_limit;
+  lval_out = out;
+  lfuel_fill(iso->fuel);
+  
+  int ok = x != NULL;
+  if (ok) {
+    x = lval_eval(iso->env, x);
+    lval_println(x);
+    lval_del(x);
+  } else {
+    fputs(err, out);
+    free(err);
   }
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-  return v;
+  
+  lval_out = prev;
+  lfuel = fuel;
+  lfuel_limit = limit;
+  return ok;
 }
 
-/* Reading */
+int jlisp_eval(jlisp_isolate* iso, const char* filename,
+               const char* input, FILE* out) {
+  char* err;
+  lval* x = jlisp_read(filename, input, &err);
+  return jlisp_eval_read(iso, x, err, out);
+}
+
+/* Scripts */
 
-lval* lval_read_num(mpc_ast_t* t) {
-  errno = 0;
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number.");
+/* A script is read a chunk at a time, and each top-level form is */
+/* evaluated as soon as it's complete. Only the form being read is */
+/* held, however big the file is */
+#define LSTREAM_CHUNK 65536
+
+typedef struct lstream {
+  FILE* in;
+  char* buf;
+  long start, end, len, cap; /* the current form is buf[start..end) */
+  char held; /* the char at buf[end], replaced by a NUL */
+  int row, col; /* where buf[start] is in the file */
+  int eof;
+  long bytes, forms;
+} lstream;
+
+void lstream_init(lstream* ls, FILE* in) {
+  memset(ls, 0, sizeof(lstream));
+  ls->in = in;
+  ls->cap = LSTREAM_CHUNK;
+  ls->buf = malloc(ls->cap + 1);
 }
 
-lval* lval_read(mpc_ast_t* t) {
+/* Read another chunk onto the end of the buffer, first moving what */
+/* is still unread to the front. Returns 0 at the end of the file */
+int lstream_fill(lstream* ls) {
+  if (ls->eof) { return 0; }
+  
+  memmove(ls->buf, ls->buf + ls->start, ls->len - ls->start);
+  ls->len -= ls->start;
+  ls->start = 0;
+  if (ls->cap - ls->len < LSTREAM_CHUNK) {
+    ls->cap *= 2;
+    ls->buf = realloc(ls->buf, ls->cap + 1);
+  }
   
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+  size_t n = fread(ls->buf + ls->len, 1, LSTREAM_CHUNK, ls->in);
+  ls->len += n;
+  ls->bytes += n;
+  if (n == 0) { ls->eof = 1; }
+  return n != 0;
+}
+
+/* Move on n chars, keeping count of the row and column */
+void lstream_skip(lstream* ls, long n) {
+  const char* s = ls->buf + ls->start;
+  long last = -1; /* the last newline */
+  for (long i = 0; i < n; i += 64) {
+    lmask m;
+    lmask_at(s + i, n - i, &m);
+    uint64_t lines = m.line & LMASK_UPTO(n - i - 1);
+    if (lines) {
+      ls->row += __builtin_popcountll(lines);
+      last = i + 63 - __builtin_clzll(lines);
+    }
+  }
+  ls->col = last < 0 ? ls->col + n : n - last - 1;
+  ls->start += n;
+}
+
+/* The next top-level form, NUL-terminated in the buffer until the */
+/* next call, or NULL at the end of the file. Finding where a form */
+/* ends only needs the brackets counted, as no token holds one. A */
+/* form that never ends runs to the end of the file, for the */
+/* reader to report */
+char* lstream_next(lstream* ls) {
+  if (ls->end > ls->start) {
+    ls->buf[ls->end] = ls->held;
+    lstream_skip(ls, ls->end - ls->start);
+    ls->end = ls->start;
+  }
   
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); } 
-  if (strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
-  if (strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
+  while (1) {
+    lstream_skip(ls, lmask_skip_space(ls->buf + ls->start, ls->len - ls->start));
+    if (ls->start < ls->len) { break; }
+    if (!lstream_fill(ls)) { return NULL; }
+  }
   
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-    if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
-    x = lval_add(x, lval_read(t->children[i]));
+  /* An atom ends at the first space or bracket after it, a list at */
+  /* its close bracket, and a stray close bracket is a form itself */
+  int k = LREAD_CLASS(ls->buf[ls->start]);
+  int list = k == LREAD_OPEN, depth = list;
+  long i = ls->start + 1;
+  while (k != LREAD_CLOSE) {
+    long n = ls->len - i;
+    long j = list ? lmask_list_end(ls->buf + i, n, &depth)
+                  : lmask_atom_end(ls->buf + i, n);
+    i += j;
+    if (list ? depth == 0 : j < n) { break; }
+    
+    /* The fill moves the form to the front even when nothing more */
+    /* comes, so i is rebased before looking at what it read */
+    long at = i - ls->start;
+    int more = lstream_fill(ls);
+    i = ls->start + at;
+    if (!more) { break; }
   }
   
-  return x;
+  ls->end = i;
+  ls->held = ls->buf[i];
+  ls->buf[i] = '\0';
+  ls->forms++;
+  return ls->buf + ls->start;
+}
+
+/* Each form is read on its own, so an error in one doesn't stop */
+/* the rest. Returns 0 if any of them couldn't be read */
+int jlisp_eval_stream(jlisp_isolate* iso, const char* filename,
+                      lstream* ls, FILE* out) {
+  int ok = 1;
+  for (char* form; (form = lstream_next(ls)); ) {
+    char* err;
+    lval* x = lread(filename, form, ls->buf + ls->end, ls->row, ls->col, &err);
+    ok &= jlisp_eval_read(iso, x, err, out);
+  }
+  return ok;
+}
+
+int jlisp_eval_file(jlisp_isolate* iso, const char* filename,
+                    FILE* in, FILE* out) {
+  lstream ls;
+  lstream_init(&ls, in);
+  int ok = jlisp_eval_stream(iso, filename, &ls, out);
+  free(ls.buf);
+  return ok;
 }
 
 /* Main */
 
 int main(int argc, char** argv) {
   
-  mpc_parser_t* Number = mpc_new("number");
-  mpc_parser_t* Symbol = mpc_new("symbol");
-  mpc_parser_t* Sexpr  = mpc_new("sexpr");
-  mpc_parser_t* Qexpr  = mpc_new("qexpr");
-  mpc_parser_t* Expr   = mpc_new("expr");
-  mpc_parser_t* Lispy  = mpc_new("lispy");
-  
-  mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                     \
-      number : /-?[0-9]+/ ;                               \
-      symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;         \
-      sexpr  : '(' <expr>* ')' ;                          \
-      qexpr  : '{' <expr>* '}' ;                          \
-      expr   : <number> | <symbol> | <sexpr> | <qexpr> ;  \
-      lispy  : /^/ <expr>* /$/ ;                          \
-    ",
-    Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  long fuel = 0;
+  char* script = NULL;
+  int stats = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+      lpool_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--parallel-args") == 0) {
+      lpar_enabled = 1;
+    } else if (strcmp(argv[i], "--fuel") == 0 && i+1 < argc) {
+      fuel = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--reader=mpc") == 0) {
+      lread_mpc = 1;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = 1;
+    } else if (!script && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) {
+      script = argv[i];
+    } else {
+      fprintf(stderr, "Usage: %s [--threads N] [--parallel-args] [--fuel N] "
+        "[--reader=mpc] [--stats] [file | -]\n", argv[0]);
+      return 1;
+    }
+  }
+  
+  /* write to a closed pipe gives an error instead */
+  signal(SIGPIPE, SIG_IGN);
+  
+  jlisp_isolate* iso = jlisp_isolate_new();
+  jlisp_set_fuel(iso, fuel);
+  
+  /* A script is run, rather than the prompt. - reads it from stdin */
+  if (script) {
+    int stdin_ = strcmp(script, "-") == 0;
+    FILE* in = stdin_ ? stdin : fopen(script, "rb");
+    if (!in) {
+      fprintf(stderr, "Could not open %s: %s\n", script, strerror(errno));
+      return 1;
+    }
+    
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    lstream ls;
+    lstream_init(&ls, in);
+    int ok = jlisp_eval_stream(iso, stdin_ ? "<stdin>" : script, &ls, stdout);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    if (stats) {
+      double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+      struct rusage ru;
+      getrusage(RUSAGE_SELF, &ru);
+      fprintf(stderr, "%li bytes, %li forms in %.3fs, %.1f MB/s, "
+        "peak RSS %li KB\n", ls.bytes, ls.forms, secs,
+        ls.bytes / 1e6 / (secs > 0 ? secs : 1), ru.ru_maxrss);
+    }
+    
+    free(ls.buf);
+    if (!stdin_) { fclose(in); }
+    fflush(stdout);
+    jlisp_isolate_del(iso);
+    return !ok;
+  }
   
   puts("Lispy Version 0.0.0.0.7");
   puts("Press Ctrl+c to Exit\n");
   
-  lenv* e = lenv_new();
-  lenv_add_builtins(e);
-  
   while (1) {
   
-    char* input = readline("lispy> ");
-    add_history(input);
-    
-    mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Lispy, &r)) {
-      lval* x = lval_eval(e, lval_read(r.output));
-      lval_println(x);
-      lval_del(x);
-      mpc_ast_delete(r.output);
-    } else {    
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+    /* Tasks carry on, and the event loop turns, until a line is */
+    /* typed */
+    char* prompt = "lispy> ";
+    if (isatty(STDIN_FILENO)) {
+      fputs(prompt, stdout);
+      fflush(stdout);
+      lio_wait(STDIN_FILENO, POLLIN);
+      prompt = "";
     }
     
+    char* input = readline(prompt);
+    add_history(input);
+    jlisp_eval(iso, "<stdin>", input, stdout);
     free(input);
     
   }
   
-  lenv_del(e);
+  jlisp_isolate_del(iso);
   
   mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
   
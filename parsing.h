@@ -1,3 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h> 
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+/* Isolates are separate interpreters in one process. Each has its */
+/* own environment, so separate threads can run separate isolates */
+/* at once. The grammar is built on first use and shared by all */
+typedef struct jlisp_isolate jlisp_isolate;
+
+jlisp_isolate* jlisp_isolate_new(void);
+void jlisp_isolate_del(jlisp_isolate* iso);
+
+/* Limit each jlisp_eval to about fuel evaluation steps, allocations */
+/* counting one per cell. An evaluation that runs out gives an */
+/* error. Tasks it spawns never run out, but let other tasks run */
+/* each time they've used fuel. 0, the default, means no limit */
+void jlisp_set_fuel(jlisp_isolate* iso, long fuel);
+
+/* Evaluate input and print the result, or why it didn't parse, to */
+/* out. Returns 0 if it didn't parse */
+int jlisp_eval(jlisp_isolate* iso, const char* filename,
+               const char* input, FILE* out);
+
+/* Evaluate each top-level form read from in as soon as it's been */
+/* read, printing each result to out. The file is never held whole, */
+/* so it can be any size. Returns 0 if any form didn't parse */
+int jlisp_eval_file(jlisp_isolate* iso, const char* filename,
+                    FILE* in, FILE* out);
@@ -0,0 +1,90 @@
+/* Double printing: ldbl_format reads back exactly, with no digit to */
+/* spare, laid out as printf's %g would */
+#include "test.h"
+
+/* xorshift, so runs are repeatable */
+uint64_t seed = 88172645463325252ull;
+uint64_t rnd(void) {
+  seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+  return seed;
+}
+
+long checked = 0;
+
+/* Significant digits in a %g style number */
+int digits(const char* s) {
+  int n = 0, lead = 1;
+  for (; *s && *s != 'e'; s++) {
+    if (*s < '0' || *s > '9') { continue; }
+    if (*s == '0' && lead) { continue; }
+    lead = 0;
+    n++;
+  }
+  return n;
+}
+
+void check(double x) {
+  if (!isfinite(x) || x == 0) { return; }
+  char s[32], g[32];
+  ldbl_format(s, x);
+  int n = digits(s);
+  CHECK(strtod(s, NULL) == x, "%a printed as %s, which reads back differently", x, s);
+  
+  /* printf's n digits are the nearest, so the same when they read back */
+  snprintf(g, sizeof(g), "%.*g", n, x);
+  CHECK(strcmp(s, g) == 0 || strtod(g, NULL) != x, "%a printed as %s, not %s", x, s, g);
+  
+  /* Neither n-1 digit decimal either side of x reads back as it */
+  if (n > 1) {
+    snprintf(g, sizeof(g), "%.*e", n-2, x);
+    int e = atoi(strchr(g, 'e') + 1) - (n-2);
+    long m = 0;
+    for (char* p = g; *p != 'e'; p++) { if (*p >= '0' && *p <= '9') { m = m*10 + *p - '0'; } }
+    for (long d = -1; d <= 1; d++) {
+      snprintf(g, sizeof(g), "%s%lde%d", x < 0 ? "-" : "", m + d, e);
+      CHECK(strtod(g, NULL) != x, "%a printed as %s, but %s reads back too", x, s, g);
+    }
+  }
+  checked++;
+}
+
+int main(void) {
+  jlisp_isolate* iso = jlisp_isolate_new();
+  
+  /* Layout and the cases printf searches get wrong: 2^-24 needs 16 */
+  /* digits, but printf's nearest 16 round the tie the wrong way */
+  const char* want[][2] = {
+    { "0.1", "0.1" }, { "1e22", "1e+22" }, { "1.5e-5", "1.5e-05" },
+    { "0.0001", "0.0001" }, { "123456.789", "123456.789" },
+    { "5e-324", "5e-324" }, { "-2.5", "-2.5" },
+    { "1.7976931348623157e308", "1.7976931348623157e+308" },
+    { "0.000000059604644775390625", "5.960464477539063e-08" },
+  };
+  for (int i = 0; i < sizeof(want) / sizeof(want[0]); i++) {
+    char s[32];
+    ldbl_format(s, strtod(want[i][0], NULL));
+    CHECK(strcmp(s, want[i][1]) == 0, "%s printed as %s, not %s", want[i][0], s, want[i][1]);
+  }
+  CHECK(strcmp(run(iso, "(/ 1.0 4)"), "0.25\n") == 0, "(/ 1.0 4) gave %s", run(iso, "(/ 1.0 4)"));
+  CHECK(strcmp(run(iso, "1e22"), "1e+22\n") == 0, "1e22 gave %s", run(iso, "1e22"));
+  
+  /* Random bits, subnormals, every power of two and its neighbours */
+  for (int t = 0; t < 500000; t++) {
+    uint64_t b = rnd();
+    double x;
+    memcpy(&x, &b, sizeof(x));
+    check(x);
+    b &= (1ull << 52) - 1;
+    memcpy(&x, &b, sizeof(x));
+    check(x);
+  }
+  for (int e = -1074; e < 1024; e++) {
+    check(ldexp(1, e));
+    check(nextafter(ldexp(1, e), 0));
+    check(nextafter(ldexp(1, e), INFINITY));
+  }
+  
+  jlisp_isolate_del(iso);
+  printf("dbl: %s (%li doubles)\n", fails ? "FAILED" : "ok", checked);
+  return fails != 0;
+}
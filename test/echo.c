@@ -0,0 +1,65 @@
+/* Event loop: thousands of tasks echoing over socketpairs, all parked */
+/* on epoll at once, and tasks reading fds that get closed under them */
+#include "test.h"
+
+int main(void) {
+  /* A hang is a failure */
+  alarm(120);
+  lpool_threads = 4;
+  jlisp_isolate* iso = jlisp_isolate_new();
+  
+  /* Two fds a pair, as many pairs as the fd limit allows up to 4000 */
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  getrlimit(RLIMIT_NOFILE, &rl);
+  int n = rl.rlim_cur > 8100 ? 4000 : (rl.rlim_cur - 100) / 2;
+  
+  /* Every server reads first, so they all park */
+  for (int i = 0; i < n; i++) {
+    runf(iso, "def {p%d} (socketpair {})", i);
+    runf(iso, "def {s%d} (spawn {write (eval (tail p%d)) (read (eval (tail p%d)) 8)})", i, i, i);
+  }
+  for (int ms = 0; ms < 30000; ms++) {
+    if (__atomic_load_n(&lio.parked, __ATOMIC_SEQ_CST) >= n) { break; }
+    poll(NULL, 0, 1);
+  }
+  int parked = __atomic_load_n(&lio.parked, __ATOMIC_SEQ_CST);
+  CHECK(parked == n, "%d of %d servers parked at once", parked, n);
+  
+  /* Then every client writes and reads its byte back */
+  for (int i = 0; i < n; i++) {
+    runf(iso, "def {c%d} (spawn {list (write (eval (head p%d)) {%d}) (read (eval (head p%d)) 8)})",
+      i, i, i % 256, i);
+  }
+  for (int i = 0; i < n; i++) {
+    char want[32];
+    snprintf(want, sizeof(want), "{1 {%d}}\n", i % 256);
+    char* got = runf(iso, "await c%d", i);
+    CHECK(strcmp(got, want) == 0, "client %d got %s", i, got);
+    got = runf(iso, "await s%d", i);
+    CHECK(strcmp(got, "1\n") == 0, "server %d gave %s", i, got);
+  }
+  for (int i = 0; i < n; i++) {
+    runf(iso, "close (eval (head p%d))", i);
+    runf(iso, "close (eval (tail p%d))", i);
+  }
+  CHECK(__atomic_load_n(&lio.parked, __ATOMIC_SEQ_CST) == 0, "tasks left parked");
+  
+  /* A task reading an fd closed under it wakes to find it closed, */
+  /* however the close and its park race */
+  for (int i = 0; i < 500; i++) {
+    runf(iso, "def {p} (socketpair {})");
+    runf(iso, "def {t} (spawn {read (eval (tail p)) 5})");
+    runf(iso, "close (eval (tail p))");
+    char* got = runf(iso, "await t");
+    CHECK(strcmp(got, "Error: Function 'read' failed: Bad file descriptor.\n") == 0,
+      "read of a closed fd gave %s", got);
+    runf(iso, "close (eval (head p))");
+  }
+  
+  jlisp_isolate_del(iso);
+  printf("echo: %s (%d tasks parked at once)\n", fails ? "FAILED" : "ok", parked);
+  return fails != 0;
+}
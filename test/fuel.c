@@ -0,0 +1,68 @@
+/* Fuel: work done by pool jobs counts against the evaluation that */
+/* started them, whichever thread they ran on */
+#include "test.h"
+
+/* Run a program with a fuel limit and keep what it prints */
+char* run_fuel(jlisp_isolate* iso, long fuel, const char* input) {
+  jlisp_set_fuel(iso, fuel);
+  return run(iso, input);
+}
+
+/* pmap eval over n items, each {+ 1 1 ...} of w ones. The fuel its */
+/* jobs used is charged as they finish, so it's the call to head */
+/* after that finds it has run out */
+char* pmap_prog(int n, int w) {
+  char* s = malloc(32 + n * (w * 2 + 8));
+  char* p = s + sprintf(s, "head (pmap eval {");
+  for (int i = 0; i < n; i++) {
+    p += sprintf(p, "{+");
+    for (int j = 0; j < w; j++) { p += sprintf(p, " 1"); }
+    p += sprintf(p, "} ");
+  }
+  sprintf(p, "})");
+  return s;
+}
+
+/* list of n arguments, each (+ (+ 1 1) ...) of w sums */
+char* args_prog(int n, int w) {
+  char* s = malloc(16 + n * (w * 8 + 8));
+  char* p = s + sprintf(s, "list");
+  for (int i = 0; i < n; i++) {
+    p += sprintf(p, " (+");
+    for (int j = 0; j < w; j++) { p += sprintf(p, " (+ 1 1)"); }
+    p += sprintf(p, ")");
+  }
+  return s;
+}
+
+int main(void) {
+  lpool_threads = 4;
+  lpar_enabled = 1;
+  jlisp_isolate* iso = jlisp_isolate_new();
+  const char* out_of_fuel = "Error: Evaluation ran out of fuel.\n";
+  
+  /* Four chunks of about 70k steps each. No one chunk runs out of */
+  /* 100k, but all four together do */
+  char* pmap = pmap_prog(256, 1000);
+  CHECK(strncmp(run_fuel(iso, 1000000, pmap), "{1000}", 6) == 0,
+    "pmap with enough fuel gave %.40s", run_fuel(iso, 1000000, pmap));
+  for (int t = 0; t < 20; t++) {
+    char* out = run_fuel(iso, 100000, pmap);
+    CHECK(strcmp(out, out_of_fuel) == 0, "pmap with 100k fuel gave %.40s", out);
+  }
+  
+  /* Same for arguments evaluated in parallel */
+  char* args = args_prog(16, 1000);
+  CHECK(strncmp(run_fuel(iso, 1000000, args), "{2000 2000", 10) == 0,
+    "parallel arguments with enough fuel gave %.40s", run_fuel(iso, 1000000, args));
+  for (int t = 0; t < 20; t++) {
+    char* out = run_fuel(iso, 20000, args);
+    CHECK(strcmp(out, out_of_fuel) == 0, "parallel arguments with 20k fuel gave %.40s", out);
+  }
+  
+  free(pmap);
+  free(args);
+  jlisp_isolate_del(iso);
+  printf("fuel: %s\n", fails ? "FAILED" : "ok");
+  return fails != 0;
+}
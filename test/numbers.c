@@ -0,0 +1,100 @@
+/* Integer literals: lread_long must agree with strtol on every value */
+/* and every overflow, and whole literals must read back as written */
+#include "test.h"
+
+long checked = 0;
+
+/* lread_long against strtol on s */
+void check(const char* s) {
+  long x = 0;
+  int ok = lread_long(s, s + strlen(s), &x);
+  errno = 0;
+  long y = strtol(s, NULL, 10);
+  int fits = errno != ERANGE;
+  CHECK(ok == fits && (!ok || x == y), "%s read as %d %li, strtol %d %li", s, ok, x, fits, y);
+  checked++;
+}
+
+int main(void) {
+  char b[128];
+  
+  /* The limits and one either side */
+  const char* edges[] = {
+    "9223372036854775806", "9223372036854775807", "9223372036854775808",
+    "-9223372036854775807", "-9223372036854775808", "-9223372036854775809",
+    "18446744073709551615", "18446744073709551616", "99999999999999999999",
+    "10000000000000000000", "0", "-0", "00", "-00",
+    "0000000000000000000000000009223372036854775807",
+    "-0000000000000000000000000009223372036854775808",
+    "0000000000000000000000000009223372036854775808",
+  };
+  for (int i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) { check(edges[i]); }
+  
+  /* 8, 16 and 19 digits, where the 8-digit blocks run out exactly, */
+  /* with and without a sign and leading zeros */
+  const char* digits = "9876543210123456789";
+  for (int n = 1; n <= 19; n++) {
+    for (int z = 0; z <= 9; z += 3) {
+      for (int neg = 0; neg < 2; neg++) {
+        snprintf(b, sizeof(b), "%s%.*s%.*s", neg ? "-" : "", z, "000000000", n, digits);
+        check(b);
+        snprintf(b, sizeof(b), "%s%.*s%.*s", neg ? "-" : "", z, "000000000", n, "9999999999999999999");
+        check(b);
+        snprintf(b, sizeof(b), "%s%.*s1%.*s", neg ? "-" : "", z, "000000000", n-1, "0000000000000000000");
+        check(b);
+      }
+    }
+  }
+  
+  /* Every value within 300 of each power of ten and two */
+  unsigned long long bases[90];
+  int nb = 0;
+  for (unsigned long long p = 1; nb < 20; p *= 10) { bases[nb++] = p; }
+  for (int i = 0; i < 64; i++) { bases[nb++] = 1ull << i; }
+  bases[nb++] = ~0ull;
+  for (int z = 0; z < 2; z++) {
+    for (int neg = 0; neg < 2; neg++) {
+      for (int i = 0; i < nb; i++) {
+        for (long d = -300; d <= 300; d++) {
+          unsigned long long v = bases[i] + d;
+          if ((d < 0 && v > bases[i]) || (d > 0 && v < bases[i])) { continue; }
+          snprintf(b, sizeof(b), "%s%s%llu", neg ? "-" : "", z ? "0000000" : "", v);
+          check(b);
+        }
+      }
+    }
+  }
+  
+  /* Random digit strings of 1 to 25 digits */
+  uint64_t seed = 88172645463325252ull;
+  for (int r = 0; r < 1000000; r++) {
+    seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+    uint64_t x = seed;
+    int n = 1 + x % 25, k = 0;
+    if ((x >> 8) & 1) { b[k++] = '-'; }
+    for (int i = 0; i < n; i++) {
+      seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+      b[k++] = '0' + seed % 10;
+    }
+    b[k] = '\0';
+    check(b);
+  }
+  
+  /* Literals print back as written, bignums past the limits */
+  jlisp_isolate* iso = jlisp_isolate_new();
+  const char* back[][2] = {
+    { "9223372036854775807", "9223372036854775807\n" },
+    { "9223372036854775808", "9223372036854775808\n" },
+    { "-9223372036854775808", "-9223372036854775808\n" },
+    { "-9223372036854775809", "-9223372036854775809\n" },
+    { "{007 -0012345678 0000000000000000000000001}", "{7 -12345678 1}\n" },
+  };
+  for (int i = 0; i < sizeof(back) / sizeof(back[0]); i++) {
+    char* out = run(iso, back[i][0]);
+    CHECK(strcmp(out, back[i][1]) == 0, "%s printed as %s", back[i][0], out);
+  }
+  jlisp_isolate_del(iso);
+  
+  printf("numbers: %s (%ld literals)\n", fails ? "FAILED" : "ok", checked);
+  return fails != 0;
+}
@@ -0,0 +1,108 @@
+/* Parallel arguments: deeply nested impure code still runs in order */
+/* and gives what serial evaluation does */
+#include "test.h"
+
+/* Run the nested program from x = 0 and keep what x ends up as */
+char* run_nest(jlisp_isolate* iso, const char* prog) {
+  run(iso, "def {x} 0");
+  run(iso, prog);
+  return run(iso, "x");
+}
+
+/* Append x wrapped in w additions of 0, heavy enough to be a job */
+char* heavy_x(char* p, int w) {
+  for (int j = 0; j < w; j++) { p += sprintf(p, "(+ 0 "); }
+  p += sprintf(p, "x");
+  for (int j = 0; j < w; j++) { p += sprintf(p, ")"); }
+  return p;
+}
+
+/* d levels of list, each a heavy sum of x, the next level, then a */
+/* heavy def of x. Every level is impure, but the sums are pure */
+/* cells worth running as jobs. A def run beside the level before it */
+/* would race with the defs in there */
+char* nest_prog(int d) {
+  int w = 2 * LPAR_GRAIN;
+  char* s = malloc(64 + d * (14 * w + 64));
+  char* p = s;
+  for (int i = 0; i < d; i++) {
+    p += sprintf(p, "(list ");
+    p = heavy_x(p, w);
+    p += sprintf(p, " ");
+  }
+  p += sprintf(p, "x");
+  for (int i = 0; i < d; i++) {
+    p += sprintf(p, " (def {x} (+ 1 (* 2 ");
+    p = heavy_x(p, w);
+    p += sprintf(p, "))))");
+  }
+  *p = '\0';
+  return s;
+}
+
+/* list of n heavy arguments each making a pipe, whose fds show */
+/* which argument ran first */
+char* pipes_prog(int n) {
+  int w = 2 * LPAR_GRAIN;
+  char* s = malloc(16 + n * (7 * w + 64));
+  char* p = s + sprintf(s, "list");
+  for (int i = 0; i < n; i++) {
+    p += sprintf(p, " (head (list (pipe {}) ");
+    p = heavy_x(p, w);
+    p += sprintf(p, "))");
+  }
+  return s;
+}
+
+/* Close every fd printed in out */
+void close_fds(const char* out) {
+  for (const char* p = out; *p; ) {
+    char* end;
+    long fd = strtol(p, &end, 10);
+    if (end == p) { p++; continue; }
+    close(fd);
+    p = end;
+  }
+}
+
+int main(void) {
+  lpool_threads = 4;
+  char* prog = nest_prog(40);
+  
+  jlisp_isolate* iso = jlisp_isolate_new();
+  char* want = strdup(run_nest(iso, prog));
+  jlisp_isolate_del(iso);
+  CHECK(strcmp(want, "1099511627775\n") == 0,
+    "serial evaluation gave %.60s", want);
+  
+  lpar_enabled = 1;
+  for (int t = 0; t < 20; t++) {
+    iso = jlisp_isolate_new();
+    char* out = run_nest(iso, prog);
+    CHECK(strcmp(out, want) == 0, "parallel arguments gave %.60s", out);
+    jlisp_isolate_del(iso);
+  }
+  
+  free(want);
+  
+  /* Making fds is impure too, so they come out in argument order */
+  char* pipes = pipes_prog(4);
+  lpar_enabled = 0;
+  iso = jlisp_isolate_new();
+  run(iso, "def {x} 0");
+  want = strdup(run(iso, pipes));
+  close_fds(want);
+  lpar_enabled = 1;
+  for (int t = 0; t < 20; t++) {
+    char* out = run(iso, pipes);
+    CHECK(strcmp(out, want) == 0, "pipes with parallel arguments gave %s, serial %s", out, want);
+    close_fds(out);
+  }
+  jlisp_isolate_del(iso);
+  
+  free(want);
+  free(pipes);
+  free(prog);
+  printf("par: %s\n", fails ? "FAILED" : "ok");
+  return fails != 0;
+}
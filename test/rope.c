@@ -0,0 +1,140 @@
+/* Ropes: random joins and slices must keep the trees balanced and */
+/* hold the same items as plain arrays put through the same steps */
+#include "test.h"
+
+/* xorshift, so runs are repeatable */
+uint64_t seed = 88172645463325252ull;
+uint64_t rnd(void) {
+  seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+  return seed;
+}
+
+/* Heights of branches differ by at most one, leaves are never empty */
+/* or too full, and counts add up. Returns how many were wrong */
+int bad_nodes(lrope* t) {
+  if (!t->height) {
+    return t->count < 1 || t->count > LROPE_LEAF;
+  }
+  int d = t->l->height - t->r->height;
+  int h = (t->l->height > t->r->height ? t->l->height : t->r->height) + 1;
+  return (d < -1 || d > 1) + (t->height != h)
+    + (t->count != t->l->count + t->r->count)
+    + bad_nodes(t->l) + bad_nodes(t->r);
+}
+
+/* Whether the items under t are the numbers at want */
+int same_items(lrope* t, long* want) {
+  if (!t) { return 1; }
+  if (t->height) {
+    return same_items(t->l, want) && same_items(t->r, want + t->l->count);
+  }
+  for (int i = 0; i < t->count; i++) {
+    if (t->item[i]->type != LVAL_NUM || t->item[i]->num != want[i]) { return 0; }
+  }
+  return 1;
+}
+
+/* A rope of the numbers at x and the model it is checked against */
+typedef struct { lrope* t; long* x; int n; } trial;
+
+trial trial_new(long* x, int n) {
+  trial r = { NULL, malloc(sizeof(long) * (n + 1)), n };
+  lval** item = malloc(sizeof(lval*) * (n + 1));
+  for (int i = 0; i < n; i++) { r.x[i] = x[i]; item[i] = lval_num(x[i]); }
+  if (n) { r.t = lrope_build(item, n); }
+  free(item);
+  return r;
+}
+
+void check(trial* r, const char* what) {
+  int n = r->t ? r->t->count : 0;
+  CHECK(n == r->n, "%s: count %d, expected %d", what, n, r->n);
+  CHECK(!r->t || bad_nodes(r->t) == 0, "%s: unbalanced, n=%d", what, r->n);
+  CHECK(n != r->n || same_items(r->t, r->x), "%s: wrong items, n=%d", what, r->n);
+}
+
+int main(void) {
+  jlisp_isolate* iso = jlisp_isolate_new();
+
+  /* Every step takes two ropes from the pool and puts back their join */
+  /* or a slice of one, keeping holds on the old ones so sharing is */
+  /* exercised. Joins are capped at 64k items */
+  enum { POOL = 16 };
+  trial pool[POOL];
+  long src[4096];
+  for (int i = 0; i < 4096; i++) { src[i] = i; }
+  for (int i = 0; i < POOL; i++) {
+    pool[i] = trial_new(src + rnd() % 2048, rnd() % 2048);
+    check(&pool[i], "build");
+  }
+
+  for (int step = 0; step < 5000; step++) {
+    int i = rnd() % POOL, j = rnd() % POOL, k = rnd() % POOL;
+    trial* a = &pool[i];
+    trial* b = &pool[j];
+    trial r;
+    int op = rnd() % 4;
+    if (op < 2 && a->n + b->n <= 1 << 16) {
+      r.n = a->n + b->n;
+      r.x = malloc(sizeof(long) * (r.n + 1));
+      memcpy(r.x, a->x, sizeof(long) * a->n);
+      memcpy(r.x + a->n, b->x, sizeof(long) * b->n);
+      r.t = lrope_join(lrope_retain(a->t), lrope_retain(b->t));
+      check(&r, "join");
+    } else {
+      /* Any slice, or one off the ends, as tail and head take */
+      int lo = rnd() % (a->n + 1);
+      int hi = lo + rnd() % (a->n - lo + 1);
+      if (op == 3) {
+        lo = rnd() % (a->n / 8 + 1);
+        hi = a->n - rnd() % (a->n / 8 + 1);
+        if (hi < lo) { hi = lo; }
+      }
+      r.n = hi - lo;
+      r.x = malloc(sizeof(long) * (r.n + 1));
+      memcpy(r.x, a->x + lo, sizeof(long) * r.n);
+      r.t = a->t ? lrope_slice(a->t, lo, hi) : NULL;
+      check(&r, "slice");
+    }
+
+    /* The old ones are unchanged by what was built from them */
+    check(a, "left operand");
+    check(b, "right operand");
+    lrope_release(pool[k].t);
+    free(pool[k].x);
+    pool[k] = r;
+  }
+  for (int i = 0; i < POOL; i++) { lrope_release(pool[i].t); free(pool[i].x); }
+
+  /* Joining two long ropes builds a path, not a copy */
+  trial big = trial_new(src, 4096);
+  lrope* t = big.t;
+  for (int i = 0; i < 8; i++) { t = lrope_join(t, lrope_retain(t)); }
+  CHECK(t->count == 4096 << 8 && bad_nodes(t) == 0, "doubled 8 times, count %d", t->count);
+  CHECK(t->height <= 16, "doubled 8 times, height %d", t->height);
+  lrope_release(t);
+  free(big.x);
+
+  /* The builtins give what they give on Q-Expressions */
+  const char* progs[] = {
+    "head (%s{1 2 3})", "tail (%s{1 2 3})", "tail (%s{1})", "head (%s{})",
+    "eval (head (%s{(+ 1 2) 4}))", "eval (%s{+ 1 2})",
+    "join (%s{1}) {2 {3}} (pair {4}) (%s{})", "cons 0 (%s{1 2})", "cons 0 (%s{})",
+    "tail (tail (join (%s{1 2}) (%s{3 4})))",
+  };
+  for (int i = 0; i < (int)(sizeof(progs) / sizeof(progs[0])); i++) {
+    char want[256], in[256];
+    snprintf(in, sizeof(in), progs[i], "", "");
+    snprintf(want, sizeof(want), "%s", run(iso, in));
+    snprintf(in, sizeof(in), progs[i], "rope ", "rope ");
+    char* got = run(iso, in);
+    CHECK(strcmp(got, want) == 0, "%s gave %s, expected %s", in, got, want);
+  }
+  CHECK(strcmp(run(iso, "rope 1"),
+    "Error: Function 'rope' passed incorrect type for argument 0. "
+    "Got Number, Expected Q-Expression.\n") == 0, "rope 1 gave %s", run(iso, "rope 1"));
+
+  jlisp_isolate_del(iso);
+  printf(fails ? "rope: FAILED\n" : "rope: ok\n");
+  return fails != 0;
+}
@@ -0,0 +1,59 @@
+/* Scripts: a final form that never closes is an error where it starts, */
+/* however the chunks it was read in fall */
+#include "test.h"
+
+/* Run a script given as a string, returning jlisp_eval_file's result */
+/* and keeping what it prints in out */
+int run_file(jlisp_isolate* iso, const char* src, char* out, size_t size) {
+  FILE* in = tmpfile();
+  fputs(src, in);
+  rewind(in);
+  FILE* f = fmemopen(out, size, "w");
+  int ok = jlisp_eval_file(iso, "f", in, f);
+  fclose(f);
+  fclose(in);
+  return ok;
+}
+
+/* rows lines of (+ 1 2), padded so the next form starts at offset */
+/* at, then tail */
+char* script(int rows, long at, const char* tail) {
+  char* s = malloc(at + strlen(tail) + 1);
+  char* p = s;
+  for (int i = 0; i < rows; i++) { p += sprintf(p, "(+ 1 2)\n"); }
+  while (p - s < at) { *p++ = ' '; }
+  strcpy(p, tail);
+  return s;
+}
+
+int main(void) {
+  jlisp_isolate* iso = jlisp_isolate_new();
+  static char out[1 << 16];
+  
+  /* Small enough for one chunk */
+  int ok = run_file(iso, "1\n((+ 5)", out, sizeof(out));
+  CHECK(!ok && strstr(out, "f:2:1: error") != NULL, "unclosed form gave %d %s", ok, out);
+  
+  ok = run_file(iso, "(+ 1 2)\n(+ 1 2)\n(+ 1 2)\n(1 2", out, sizeof(out));
+  CHECK(!ok && strstr(out, "f:4:1: error") != NULL, "unclosed list gave %d %s", ok, out);
+  
+  /* Starting either side of, and on, the end of the first chunk */
+  for (long at = LSTREAM_CHUNK - 8; at <= LSTREAM_CHUNK + 8; at++) {
+    char* s = script(3, at, "((+ 5)");
+    char want[64];
+    snprintf(want, sizeof(want), "f:4:%li: error", at - 24 + 1);
+    ok = run_file(iso, s, out, sizeof(out));
+    CHECK(!ok && strstr(out, want) != NULL, "unclosed form at %li gave %d %.80s", at, ok, out);
+    free(s);
+  }
+  
+  /* A closed form at the very end still evaluates */
+  char* s = script(3, LSTREAM_CHUNK - 4, "(+ 5 1)");
+  ok = run_file(iso, s, out, sizeof(out));
+  CHECK(ok && strcmp(out, "3\n3\n3\n6\n") == 0, "closed final form gave %d %s", ok, out);
+  free(s);
+  
+  jlisp_isolate_del(iso);
+  printf("stream: %s\n", fails ? "FAILED" : "ok");
+  return fails != 0;
+}
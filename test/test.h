@@ -0,0 +1,29 @@
+/* What every test shares. Each includes parsing.c whole, so it can */
+/* reach the kernels behind the builtins */
+#define main jlisp_main
+#include "../parsing.c"
+#undef main
+
+int fails = 0;
+
+#define CHECK(cond, ...) \
+  if (!(cond)) { fails++; printf("FAIL: " __VA_ARGS__); putchar('\n'); }
+
+/* Run a program and keep what it prints, until the next run */
+char* run(jlisp_isolate* iso, const char* input) {
+  static char out[1 << 16];
+  FILE* f = fmemopen(out, sizeof(out), "w");
+  jlisp_eval(iso, "test", input, f);
+  fclose(f);
+  return out;
+}
+
+/* The same for a program put together by printf */
+char* runf(jlisp_isolate* iso, const char* fmt, ...) {
+  char in[4096];
+  va_list va;
+  va_start(va, fmt);
+  vsnprintf(in, sizeof(in), fmt, va);
+  va_end(va);
+  return run(iso, in);
+}
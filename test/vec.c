@@ -0,0 +1,125 @@
+/* Vector kernels: every installed kernel must give what the scalar one */
+/* gives, and integer sums overflow only when the exact total does */
+#include "test.h"
+
+/* xorshift, so runs are repeatable */
+uint64_t seed = 88172645463325252ull;
+uint64_t rnd(void) {
+  seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+  return seed;
+}
+
+/* The sum by the scalar and installed reducers against 128-bit maths */
+void check_sum(lnum* a, int n) {
+  __int128 exact = 0;
+  for (int i = 0; i < n; i++) { exact += a[i].i; }
+  int fits = exact >= INT64_MIN && exact <= INT64_MAX;
+  
+  lnum r1 = { 0 }, r2 = { 0 };
+  int s1 = lvec_sum_i(&r1, a, n);
+  int s2 = lvec_reducers[0][LVEC_ADD](&r2, a, n);
+  CHECK(s1 == (fits ? LVEC_OK : LVEC_OVERFLOW), "scalar sum status %d, n=%d", s1, n);
+  CHECK(s2 == s1, "installed sum status %d, scalar %d, n=%d", s2, s1, n);
+  if (fits && s1 == LVEC_OK && s2 == LVEC_OK) {
+    CHECK(r1.i == (int64_t)exact && r2.i == r1.i,
+      "sum %li and %li, expected %li", (long)r1.i, (long)r2.i, (long)exact);
+  }
+}
+
+int main(void) {
+  jlisp_isolate* iso = jlisp_isolate_new();
+  lvec_reducer installed = lvec_reducers[0][LVEC_ADD];
+  
+  /* A lane passes through INT64_MAX but the total is in range */
+  const char* prog = "(vsum (vec {9223372036854775807 -1 0 0 1 0 0 0}))";
+  lvec_reducers[0][LVEC_ADD] = lvec_sum_i;
+  char scalar[64];
+  snprintf(scalar, sizeof(scalar), "%s", run(iso, prog));
+  lvec_reducers[0][LVEC_ADD] = installed;
+  CHECK(strcmp(scalar, "9223372036854775807\n") == 0, "scalar vsum gave %s", scalar);
+  CHECK(strcmp(run(iso, prog), scalar) == 0, "installed vsum gave %s", run(iso, prog));
+  
+  lnum edge[][8] = {
+    { {INT64_MAX}, {-1}, {0}, {0}, {1}, {0}, {0}, {0} },
+    { {INT64_MAX}, {1}, {-1}, {0}, {0}, {0}, {0}, {0} },
+    { {INT64_MIN}, {-1}, {1}, {0}, {0}, {0}, {0}, {0} },
+    { {INT64_MAX}, {INT64_MAX}, {INT64_MIN}, {INT64_MIN}, {1}, {0}, {0}, {0} },
+    { {INT64_MAX}, {0}, {0}, {0}, {1}, {0}, {0}, {0} },
+    { {INT64_MIN}, {0}, {0}, {0}, {-1}, {0}, {0}, {0} },
+  };
+  for (int i = 0; i < sizeof(edge) / sizeof(edge[0]); i++) { check_sum(edge[i], 8); }
+  
+  /* Random lengths, mostly huge values so lanes wrap both ways */
+  lnum a[67];
+  for (int t = 0; t < 200000; t++) {
+    int n = rnd() % 67;
+    for (int i = 0; i < n; i++) {
+      uint64_t x = rnd();
+      a[i].i = (x & 3) ? (int64_t)rnd() : (int64_t)(rnd() % 2001) - 1000;
+    }
+    /* Half the time cancel out the total so far to land near the range */
+    if (n > 0 && (rnd() & 1)) {
+      __int128 s = 0;
+      for (int i = 0; i < n-1; i++) { s += a[i].i; }
+      __int128 want = (__int128)(int64_t)rnd() - s;
+      if (want >= INT64_MIN && want <= INT64_MAX) { a[n-1].i = (int64_t)want; }
+    }
+    check_sum(a, n);
+  }
+  
+  /* Element-wise kernels against the scalar ones */
+  lnum b[67], r1[67], r2[67];
+  for (int op = LVEC_ADD; op < LVEC_NOPS; op++) {
+    for (int dbl = 0; dbl < 2; dbl++) {
+      if (!dbl && op == LVEC_MUL) { continue; }
+      lvec_kernel scalar = (lvec_kernel[2][LVEC_NOPS]){
+        { lvec_add_i, lvec_sub_i, lvec_mul_i, lvec_div_i,
+          lvec_lt_i, lvec_gt_i, lvec_eq_i },
+        { lvec_add_d, lvec_sub_d, lvec_mul_d, lvec_div_d,
+          lvec_lt_d, lvec_gt_d, lvec_eq_d } }[dbl][op];
+      for (int t = 0; t < 20000; t++) {
+        int n = rnd() % 67;
+        for (int i = 0; i < n; i++) {
+          if (dbl) { a[i].d = (double)(int64_t)rnd() / (1 + rnd() % 1000);
+                     b[i].d = (rnd() & 7) ? (double)(int64_t)rnd() / 1e9 : a[i].d; }
+          else { a[i].i = (int64_t)rnd() >> (rnd() % 64);
+                 b[i].i = (rnd() & 7) ? (int64_t)rnd() >> (rnd() % 64) : a[i].i;
+                 if (b[i].i == 0) { b[i].i = 1; } }
+        }
+        int s1 = scalar(r1, a, b, n);
+        int s2 = lvec_kernels[dbl][op](r2, a, b, n);
+        CHECK((s1 == LVEC_OK) == (s2 == LVEC_OK), "op %d dbl %d status %d, scalar %d", op, dbl, s2, s1);
+        if (s1 == LVEC_OK && s2 == LVEC_OK) {
+          CHECK(memcmp(r1, r2, sizeof(lnum) * n) == 0, "op %d dbl %d results differ", op, dbl);
+        }
+      }
+    }
+  }
+  
+  /* Dividing by a zero lane is an error, as / on doubles is, wherever */
+  /* the lane falls and whichever kernel finds it */
+  CHECK(strcmp(run(iso, "(/ 1.0 0)"), "Error: Division By Zero.\n") == 0,
+    "(/ 1.0 0) gave %s", run(iso, "(/ 1.0 0)"));
+  const char* zeros[] = {
+    "(/ (vec {1.0 2.0}) 0)",
+    "(/ (vec {1.0 2.0 3.0 4.0 5.0}) (vec {1.0 2.0 0.0 4.0 5.0}))",
+    "(/ (vec {1.0 2.0 3.0 4.0 5.0}) (vec {1.0 2.0 3.0 4.0 -0.0}))",
+    "(/ (vec {1 2 3 4 5}) (vec {1.0 0.0 3.0 4.0 5.0}))",
+  };
+  for (int i = 0; i < sizeof(zeros) / sizeof(zeros[0]); i++) {
+    char* out = run(iso, zeros[i]);
+    CHECK(strcmp(out, "Error: Division By Zero.\n") == 0, "%s gave %s", zeros[i], out);
+  }
+  for (int n = 0; n < 16; n++) {
+    for (int z = 0; z < n; z++) {
+      for (int i = 0; i < n; i++) { a[i].d = i + 1; b[i].d = i == z ? 0 : 2; }
+      CHECK(lvec_div_d(r1, a, b, n) == LVEC_DIV_ZERO, "scalar missed zero %d of %d", z, n);
+      CHECK(lvec_kernels[1][LVEC_DIV](r2, a, b, n) == LVEC_DIV_ZERO,
+        "installed missed zero %d of %d", z, n);
+    }
+  }
+  
+  printf("vec: %s (%s kernels)\n", fails ? "FAILED" : "ok",
+    installed == lvec_sum_i ? "scalar" : "AVX2");
+  return fails != 0;
+}